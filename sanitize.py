@@ -54,7 +54,7 @@ class Sanitizer(object):
         c = self.libsanitize.sanitize(s.encode('utf-8'), self.mode)
         r = ctypes.cast(c, ctypes.c_char_p).value
         self.libc.free(c)
-        if r:
+        if r is not None:
             return r.decode('utf-8')
         else:
             return r
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define FIRST_BLOCK_SIZE (4096)
+#define ALIGNMENT (sizeof(void *) > sizeof(double) ? sizeof(void *) : sizeof(double))
+
+struct Block
+{
+  struct Block *next;
+  size_t size;                  /* of data */
+  size_t used;
+  char *data;
+};
+
+struct Arena
+{
+  struct Block *blocks;         /* the newest first */
+  size_t size;
+};
+
+Arena *arena_new(void)
+{
+  Arena *arena = malloc(sizeof(struct Arena));
+  arena->blocks = NULL;
+  arena->size = 0;
+  return arena;
+}
+
+void arena_free(Arena *arena)
+{
+  struct Block *block, *next;
+
+  if (!arena)
+    return;
+  for (block = arena->blocks; block; block = next)
+    {
+      next = block->next;
+      free(block);
+    }
+  free(arena);
+}
+
+static struct Block *add_block(Arena *arena, size_t min_size)
+{
+  size_t size = arena->blocks ? 2 * arena->blocks->size : FIRST_BLOCK_SIZE;
+  size_t header = (sizeof(struct Block) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  struct Block *block;
+
+  while (size < min_size)
+    size *= 2;
+
+  block = malloc(header + size);
+  if (!block)
+    return NULL;
+  block->data = (char *)block + header;
+  block->size = size;
+  block->used = 0;
+  block->next = arena->blocks;
+  arena->blocks = block;
+  arena->size += header + size;
+  return block;
+}
+
+static void *bump(Arena *arena, size_t size, size_t alignment)
+{
+  struct Block *block = arena->blocks;
+  size_t offset = 0;
+  void *ptr;
+
+  if (block)
+    offset = (block->used + alignment - 1) / alignment * alignment;
+  if (!block || offset > block->size || block->size - offset < size)
+    {
+      block = add_block(arena, size);
+      if (!block)
+        return NULL;
+      offset = 0;
+    }
+
+  ptr = block->data + offset;
+  block->used = offset + size;
+  return ptr;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+  return bump(arena, size, ALIGNMENT);
+}
+
+void *arena_calloc(Arena *arena, size_t count, size_t size)
+{
+  void *ptr = bump(arena, count * size, ALIGNMENT);
+
+  if (ptr)
+    memset(ptr, 0, count * size);
+  return ptr;
+}
+
+char *arena_strndup(Arena *arena, const char *str, size_t len)
+{
+  char *copy = bump(arena, len + 1, 1);    /* strings need no alignment */
+
+  if (!copy)
+    return NULL;
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+char *arena_strdup(Arena *arena, const char *str)
+{
+  return arena_strndup(arena, str, strlen(str));
+}
+
+int arena_owns(const Arena *arena, const void *ptr)
+{
+  const struct Block *block;
+
+  if (!arena)
+    return 0;
+  for (block = arena->blocks; block; block = block->next)
+    if ((const char *)ptr >= block->data && (const char *)ptr < block->data + block->size)
+      return 1;
+  return 0;
+}
+
+size_t arena_size(const Arena *arena)
+{
+  return arena ? arena->size : 0;
+}
@@ -0,0 +1,28 @@
+#ifndef SANITIZE_ARENA_H_INCLUDED
+#define SANITIZE_ARENA_H_INCLUDED
+
+#include <stddef.h>
+
+/*
+ * Bump allocator. Memory is handed out from blocks that double in size
+ * and is only released all at once, by arena_free(). Whether an address
+ * came from the arena is a range check per block, of which there are
+ * only a handful.
+ */
+
+typedef struct Arena Arena;
+
+Arena *arena_new(void);
+void arena_free(Arena *arena);
+
+/* aligned for any type */
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_calloc(Arena *arena, size_t count, size_t size);
+char *arena_strdup(Arena *arena, const char *str);
+char *arena_strndup(Arena *arena, const char *str, size_t len);
+
+int arena_owns(const Arena *arena, const void *ptr);
+/* bytes taken from the system */
+size_t arena_size(const Arena *arena);
+
+#endif
@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sanitize.h"
+
+/*
+ * Work stealing over index ranges. Every worker starts with an equal
+ * share of the batch and takes items from the front of its own range;
+ * a worker that runs dry steals the back half of the fullest other
+ * range, so one huge input does not leave the rest of the batch queued
+ * behind it.
+ */
+
+struct Range
+{
+  pthread_mutex_t lock;
+  size_t begin;
+  size_t end;
+};
+
+struct Batch
+{
+  const char **inputs;
+  const size_t *lens;
+  char **outputs;
+  struct sanitize_mode *mode;
+  struct Range *ranges;
+  size_t worker_count;
+};
+
+struct Worker
+{
+  struct Batch *batch;
+  size_t index;
+  pthread_t thread;
+};
+
+static int take(struct Range *range, size_t *item)
+{
+  int found = 0;
+
+  pthread_mutex_lock(&range->lock);
+  if (range->begin < range->end)
+    {
+      *item = range->begin++;
+      found = 1;
+    }
+  pthread_mutex_unlock(&range->lock);
+  return found;
+}
+
+static int steal(struct Batch *batch, size_t thief)
+{
+  size_t victim = batch->worker_count, most = 0, i;
+  size_t begin, end;
+
+  for (i = 0; i < batch->worker_count; ++i)
+    {
+      struct Range *range = &batch->ranges[i];
+      size_t size;
+
+      if (i == thief)
+        continue;
+      pthread_mutex_lock(&range->lock);
+      size = range->end - range->begin;
+      pthread_mutex_unlock(&range->lock);
+      if (size > most)
+        {
+          most = size;
+          victim = i;
+        }
+    }
+
+  if (victim == batch->worker_count)
+    return 0;
+
+  pthread_mutex_lock(&batch->ranges[victim].lock);
+  end = batch->ranges[victim].end;
+  begin = batch->ranges[victim].begin;
+  begin = end - (end - begin + 1) / 2;  /* the back half, at least one item */
+  batch->ranges[victim].end = begin;
+  pthread_mutex_unlock(&batch->ranges[victim].lock);
+
+  if (begin == end)
+    return 1;                   /* emptied meanwhile: look again */
+
+  pthread_mutex_lock(&batch->ranges[thief].lock);
+  batch->ranges[thief].begin = begin;
+  batch->ranges[thief].end = end;
+  pthread_mutex_unlock(&batch->ranges[thief].lock);
+  return 1;
+}
+
+static char *copy_output(const char *output)
+{
+  size_t len;
+  char *result;
+
+  if (!output)
+    return NULL;
+  len = strlen(output);
+  result = malloc(len + 1);
+  memcpy(result, output, len + 1);
+  return result;
+}
+
+static void *worker_run(void *arg)
+{
+  struct Worker *worker = arg;
+  struct Batch *batch = worker->batch;
+  struct sanitize_ctx *ctx = sanitize_ctx_new(batch->mode);
+  size_t item;
+
+  for (;;)
+    {
+      while (take(&batch->ranges[worker->index], &item))
+        {
+          const char *input = batch->inputs[item];
+          const size_t len = batch->lens ? batch->lens[item] : strlen(input);
+
+          batch->outputs[item] = ctx ? copy_output(sanitize_ctx_run(ctx, input, len)) : NULL;
+        }
+      if (!steal(batch, worker->index))
+        break;
+    }
+
+  sanitize_ctx_free(ctx);
+  return NULL;
+}
+
+int sanitize_batch(const char **inputs, const size_t *lens, size_t n, struct sanitize_mode *mode, char **outputs, int threads)
+{
+  struct Batch batch;
+  struct Worker *workers;
+  size_t worker_count, i, started;
+  int result = 0;
+
+  if (threads <= 0)
+    {
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      threads = cpus > 0 ? cpus : 1;
+    }
+  worker_count = (size_t)threads < n ? (size_t)threads : n;
+  if (!worker_count)
+    return 0;
+
+  sanitize_init();
+
+  batch.inputs = inputs;
+  batch.lens = lens;
+  batch.outputs = outputs;
+  batch.mode = mode;
+  batch.worker_count = worker_count;
+  batch.ranges = malloc(worker_count * sizeof(struct Range));
+  workers = malloc(worker_count * sizeof(struct Worker));
+
+  for (i = 0; i < worker_count; ++i)
+    {
+      pthread_mutex_init(&batch.ranges[i].lock, NULL);
+      batch.ranges[i].begin = n * i / worker_count;
+      batch.ranges[i].end = n * (i + 1) / worker_count;
+      workers[i].batch = &batch;
+      workers[i].index = i;
+    }
+
+  /* the calling thread is worker 0 */
+  for (started = 1; started < worker_count; ++started)
+    if (pthread_create(&workers[started].thread, NULL, worker_run, &workers[started]))
+      break;
+  worker_run(&workers[0]);      /* returns once every range is empty, stealing from workers that failed to start */
+  for (i = 1; i < started; ++i)
+    pthread_join(workers[i].thread, NULL);
+
+  for (i = 0; i < worker_count; ++i)
+    pthread_mutex_destroy(&batch.ranges[i].lock);
+  for (i = 0; i < n; ++i)
+    if (!outputs[i])
+      result = -1;
+  free(workers);
+  free(batch.ranges);
+
+  return result;
+}
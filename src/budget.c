@@ -0,0 +1,44 @@
+#include "budget.h"
+
+static int exceed(Budget *budget)
+{
+  budget->exceeded = 1;
+  return 0;
+}
+
+int budget_init(Budget *budget, const struct sanitize_limits *limits, size_t input_bytes)
+{
+  budget->limits = limits;
+  budget->depth = budget->nodes = budget->attributes = 0;
+  budget->exceeded = 0;
+  if (limits->max_input && input_bytes > limits->max_input)
+    return exceed(budget);
+  return 1;
+}
+
+int budget_start_element(Budget *budget, const xmlChar **atts)
+{
+  const struct sanitize_limits *limits = budget->limits;
+
+  ++budget->depth;
+  for (; atts && atts[0]; atts += 2)
+    ++budget->attributes;
+  if (budget->exceeded ||
+      (limits->max_depth && budget->depth > limits->max_depth) ||
+      (limits->max_attributes && budget->attributes > limits->max_attributes))
+    return exceed(budget);
+  return budget_node(budget);
+}
+
+void budget_end_element(Budget *budget)
+{
+  if (budget->depth)
+    --budget->depth;
+}
+
+int budget_node(Budget *budget)
+{
+  if (budget->exceeded || (budget->limits->max_nodes && ++budget->nodes > budget->limits->max_nodes))
+    return exceed(budget);
+  return 1;
+}
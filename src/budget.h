@@ -0,0 +1,48 @@
+#ifndef SANITIZE_BUDGET_H_INCLUDED
+#define SANITIZE_BUDGET_H_INCLUDED
+
+#include <stddef.h>
+#include <libxml/xmlstring.h>
+
+/*
+ * Per-call limits of a mode; 0 leaves a limit off. They are checked as
+ * the input is parsed, so a call that goes beyond one stops there and
+ * returns SANITIZE_LIMIT_EXCEEDED, or, with escape set, gives the whole
+ * input as escaped text instead. Either way, no call parses or cleans
+ * more than the limits allow.
+ *
+ * Input longer than max_input is refused even with escape set: escaping
+ * it would write several times its size.
+ */
+
+struct sanitize_limits
+{
+  size_t max_input;             /* bytes */
+  unsigned long max_depth;      /* elements open at once */
+  unsigned long max_nodes;      /* elements, text and comments */
+  unsigned long max_attributes; /* over the whole input */
+  int escape;
+};
+
+#define SANITIZE_LIMIT_EXCEEDED (-2)
+
+/* what a call has used up of the limits */
+
+typedef struct Budget Budget;
+
+struct Budget
+{
+  const struct sanitize_limits *limits;
+  unsigned long depth, nodes, attributes;
+  int exceeded;
+};
+
+/* 0 once the input is too long */
+int budget_init(Budget *budget, const struct sanitize_limits *limits, size_t input_bytes);
+/* 0 once the element goes beyond a limit */
+int budget_start_element(Budget *budget, const xmlChar **atts);
+void budget_end_element(Budget *budget);
+/* text or comments; 0 beyond the limit */
+int budget_node(Budget *budget);
+
+#endif
@@ -0,0 +1,43 @@
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+
+void buffer_init(Buffer *buf)
+{
+  buf->data = NULL;
+  buf->length = 0;
+  buf->allocated = 0;
+}
+
+void buffer_destroy(Buffer *buf)
+{
+  free(buf->data);
+  buffer_init(buf);
+}
+
+/* room for count more bytes plus a terminating NUL */
+void buffer_reserve(Buffer *buf, size_t count)
+{
+  size_t needed = buf->length + count + 1;
+
+  if (needed <= buf->allocated)
+    return;
+
+  if (!buf->allocated)
+    buf->allocated = 256;
+  while (buf->allocated < needed)
+    buf->allocated *= 2;
+  buf->data = realloc(buf->data, buf->allocated);
+}
+
+void buffer_append(Buffer *buf, const char *data, size_t len)
+{
+  buffer_reserve(buf, len);
+  memcpy(buf->data + buf->length, data, len);
+  buf->length += len;
+}
+
+void buffer_append_string(Buffer *buf, const char *str)
+{
+  buffer_append(buf, str, strlen(str));
+}
@@ -0,0 +1,35 @@
+#ifndef SANITIZE_BUFFER_H_INCLUDED
+#define SANITIZE_BUFFER_H_INCLUDED
+
+#include <stddef.h>
+
+/* growable byte buffer with geometric growth */
+
+typedef struct Buffer Buffer;
+
+struct Buffer
+{
+  char *data;
+  size_t length;
+  size_t allocated;
+};
+
+void buffer_init(Buffer *buf);
+void buffer_destroy(Buffer *buf);
+void buffer_reserve(Buffer *buf, size_t count);
+void buffer_append(Buffer *buf, const char *data, size_t len);
+void buffer_append_string(Buffer *buf, const char *str);
+
+static inline void buffer_clear(Buffer *buf)
+{
+  buf->length = 0;
+}
+
+static inline void buffer_append_char(Buffer *buf, char c)
+{
+  if (buf->length + 1 >= buf->allocated)
+    buffer_reserve(buf, 1);
+  buf->data[buf->length++] = c;
+}
+
+#endif
@@ -6,17 +6,20 @@ int ptr_less(const void* o1, const void *o2)
   return o1 < o2;
 }
 
+/* FNV-1a, then a final avalanche so that the low bits depend on every byte */
 unsigned hash_function(const char *str, size_t len)
 {
-  unsigned hash;
+  unsigned hash = 2166136261u;
   size_t i;
 
-  if (!len)
-    len = strlen(str);
-
-  hash = 0;
   for (i = 0; i < len; ++i)
-    hash = str[i] + 31 * hash;
+    hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
   return hash;
 }
 
@@ -1,79 +1,115 @@
 #include <stdlib.h>
 #include <string.h>
 #include "dict.h"
+#include "arena.h"
 
-#define HASH_SIZE (97)
+/*
+ * Open addressing with linear probing. Each entry keeps its key's hash
+ * and length, so that a probe only compares the bytes of a key whose
+ * hash and length both match. The table doubles once it is 3/4 full;
+ * entries are never removed.
+ *
+ * A dict made with dict_new_in() takes all its memory, keys included,
+ * from an arena, and goes away with it.
+ */
 
-struct HashValue
-{
-  char *key;
-  void *value;
-};
+#define INITIAL_SIZE (8)
 
-struct Bucket
+struct Entry
 {
-  unsigned count;
-  unsigned allocated;
-  struct HashValue *values;
+  char *key;                    /* NULL: empty slot */
+  size_t key_len;
+  unsigned hash;
+  void *value;
 };
 
 struct Dict
 {
+  Arena *arena;                 /* NULL: malloc() */
   free_function_t value_free;
-  struct Bucket data[HASH_SIZE];
+  size_t mask;
+  size_t count;
+  struct Entry *entries;
 };
 
+static struct Entry *new_entries(Dict *dict, size_t count)
+{
+  if (dict->arena)
+    return arena_calloc(dict->arena, count, sizeof(struct Entry));
+  return calloc(count, sizeof(struct Entry));
+}
+
 Dict *dict_new(free_function_t value_free_func)
 {
   Dict *dict = malloc(sizeof(struct Dict));
-  memset(dict, 0, sizeof(struct Dict));
+  dict->arena = NULL;
   dict->value_free = value_free_func;
+  dict->mask = INITIAL_SIZE - 1;
+  dict->count = 0;
+  dict->entries = new_entries(dict, INITIAL_SIZE);
+  return dict;
+}
+
+Dict *dict_new_in(Arena *arena)
+{
+  Dict *dict = arena_alloc(arena, sizeof(struct Dict));
+  dict->arena = arena;
+  dict->value_free = NULL;
+  dict->mask = INITIAL_SIZE - 1;
+  dict->count = 0;
+  dict->entries = new_entries(dict, INITIAL_SIZE);
   return dict;
 }
 
 void dict_free(Dict *dict)
 {
-  if (dict)
+  if (dict && !dict->arena)
     {
-      unsigned i, j;
+      size_t i;
 
-      for (i = 0; i < HASH_SIZE; ++i)
+      for (i = 0; i <= dict->mask; ++i)
 	{
-	  struct Bucket *bucket = &dict->data[i];
-
-	  for (j = 0; j < bucket->count; ++j)
-	    free(bucket->values[j].key);
-
-	  if (dict->value_free)
-	    for (j = 0; j < bucket->count; ++j)
-	      if (bucket->values[j].value)
-		dict->value_free(bucket->values[j].value);
+	  struct Entry *entry = &dict->entries[i];
 
-	  free(dict->data[i].values);
+	  if (!entry->key)
+	    continue;
+	  free(entry->key);
+	  if (dict->value_free && entry->value)
+	    dict->value_free(entry->value);
 	}
 
+      free(dict->entries);
       free(dict);
     }
 }
 
-static int dict_find(Dict *dict, const char *key, size_t key_len, struct Bucket **bucket, unsigned *index)
+/* the entry holding key, or the empty slot where it belongs */
+static struct Entry *dict_find(const Dict *dict, const char *key, size_t key_len, unsigned hash)
 {
-  const unsigned hash = hash_function(key, key_len);
-  unsigned i;
+  size_t i;
 
-  *bucket = &dict->data[hash % HASH_SIZE];
-
-  for (i = 0; i < (*bucket)->count; ++i)
+  for (i = hash & dict->mask; ; i = (i + 1) & dict->mask)
     {
-      if (!strncmp((*bucket)->values[i].key, key, key_len))
-	{
-	  *index = i;
-	  return 1;
-	}
+      struct Entry *entry = &dict->entries[i];
+
+      if (!entry->key ||
+	  (entry->hash == hash && entry->key_len == key_len && !memcmp(entry->key, key, key_len)))
+	return entry;
     }
-  
-  *index = -1;
-  return 0;
+}
+
+static void dict_grow(Dict *dict)
+{
+  struct Entry *old = dict->entries;
+  size_t i, size = dict->mask + 1;
+
+  dict->mask = 2 * size - 1;
+  dict->entries = new_entries(dict, 2 * size);
+  for (i = 0; i < size; ++i)
+    if (old[i].key)
+      *dict_find(dict, old[i].key, old[i].key_len, old[i].hash) = old[i];
+  if (!dict->arena)
+    free(old);
 }
 
 void dict_replace(Dict *dict, const char *key, void *value)
@@ -83,32 +119,41 @@ void dict_replace(Dict *dict, const char *key, void *value)
 
 void dict_replacen(Dict *dict, const char *key, size_t key_len, void *value)
 {
+  struct Entry *entry;
+  unsigned hash;
+
   if (!dict || !key)
     return;
 
-  struct Bucket *bucket;
-  unsigned index;
+  hash = hash_function(key, key_len);
+  entry = dict_find(dict, key, key_len, hash);
 
-  if (dict_find(dict, key, key_len, &bucket, &index))
+  if (entry->key)
     {
-      void *old_value = bucket->values[index].value;
-      if (dict->value_free && old_value)
-	dict->value_free(old_value);
-      bucket->values[index].value = value;
+      if (dict->value_free && entry->value)
+	dict->value_free(entry->value);
+      entry->value = value;
+      return;
     }
-  else
+
+  if (4 * (dict->count + 1) > 3 * (dict->mask + 1))
     {
-      /* grow bucket */
-      if (bucket->count + 1 >= bucket->allocated)
-	{
-	  bucket->allocated = align_size_8(bucket->count + 1);
-	  bucket->values = realloc(bucket->values, bucket->allocated * sizeof(struct HashValue));
-	}
+      dict_grow(dict);
+      entry = dict_find(dict, key, key_len, hash);
+    }
 
-      bucket->values[bucket->count].key = strdup(key);
-      bucket->values[bucket->count].value = value;
-      ++bucket->count;
+  if (dict->arena)
+    entry->key = arena_strndup(dict->arena, key, key_len);
+  else
+    {
+      entry->key = malloc(key_len + 1);
+      memcpy(entry->key, key, key_len);
+      entry->key[key_len] = '\0';
     }
+  entry->key_len = key_len;
+  entry->hash = hash;
+  entry->value = value;
+  ++dict->count;
 }
 
 void *dict_get(Dict *dict, const char *key)
@@ -118,32 +163,17 @@ void *dict_get(Dict *dict, const char *key)
 
 void *dict_getn(Dict *dict, const char *key, size_t key_len)
 {
-  struct Bucket *bucket;
-  unsigned index;
-
-  if (dict_find(dict, key, key_len, &bucket, &index))
-    {
-      return bucket->values[index].value;
-    }
-  else
-    {
-      return NULL;
-    }
+  return dict_find(dict, key, key_len, hash_function(key, key_len))->value;
 }
 
 Array *dict_keys(Dict *dict)
 {
   Array *keys = array_new((free_function_t)free);
+  size_t i;
 
-  unsigned i, j;
-
-  for (i = 0; i < HASH_SIZE; ++i)
-    {
-      struct Bucket *bucket = &dict->data[i];
-
-      for (j = 0; j < bucket->count; ++j)
-	array_append(keys, strdup(bucket->values[j].key));
-    }
+  for (i = 0; i <= dict->mask; ++i)
+    if (dict->entries[i].key)
+      array_append(keys, strdup(dict->entries[i].key));
 
   return keys;
 }
@@ -3,10 +3,13 @@
 
 #include "common.h"
 #include "array.h"
- 
+#include "arena.h"
+
 typedef struct Dict Dict;
 
 Dict *dict_new(free_function_t value_free_func);
+/* everything in the arena: no value_free, and no dict_free() needed */
+Dict *dict_new_in(Arena *arena);
 void dict_free(Dict *dict);
 void dict_replace(Dict *dict, const char *key, void *value);
 void dict_replacen(Dict *dict, const char *key, size_t key_len, void *value);
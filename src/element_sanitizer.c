@@ -2,59 +2,216 @@
 #include <string.h>
 
 #include "element_sanitizer.h"
-
-#include "value_checker.h"
+#include "name_index.h"
+#include "image.h"
 
 struct ElementSanitizer {
+  Arena *arena;
   Dict *attributes;              /* attr name --> value checker */
-  Dict *mandatory_attributes;    /* attr name --> value */
+  NameIndex *interned;           /* the same, by interned name; NULL once stale */
+  struct MandatoryAttribute *mandatory_attributes;
+  size_t mandatory_attributes_count;
 };
 
-ElementSanitizer *element_sanitizer_new(void)
+ElementSanitizer *element_sanitizer_new(Arena *arena)
 {
-  ElementSanitizer *es = malloc(sizeof(struct ElementSanitizer));
-  es->attributes = dict_new((free_function_t)value_checker_free);
-  es->mandatory_attributes = dict_new((free_function_t)free);
+  ElementSanitizer *es = arena_alloc(arena, sizeof(struct ElementSanitizer));
+  es->arena = arena;
+  es->attributes = dict_new_in(arena);
+  es->interned = NULL;
+  es->mandatory_attributes = NULL;
+  es->mandatory_attributes_count = 0;
   return es;
 }
 
-void element_sanitizer_free(ElementSanitizer *es)
+void element_sanitizer_set_checker(ElementSanitizer *es, const char *attribute, ValueChecker *vc)
 {
-  if (!es)
-    return;
-  dict_free(es->attributes);
-  dict_free(es->mandatory_attributes);
-  free(es);
+  dict_replace(es->attributes, attribute, vc);
+  es->interned = NULL;
 }
 
-void element_sanitizer_add_regex(ElementSanitizer *es, const char *attribute, const char *re, int inverted)
+int element_sanitizer_is_valid(ElementSanitizer *es, const char *attribute, const char *value, struct StatsTally *tally)
 {
   ValueChecker *vc;
 
   vc = dict_get(es->attributes, attribute);
-  if (!vc)
-    {
-      vc = value_checker_new();
-      dict_replace(es->attributes, attribute, vc);
-    }
+  return value_checker_check(vc, value, tally);
+}
+
+ValueChecker *element_sanitizer_get_checker(ElementSanitizer *es, const char *attribute)
+{
+  return dict_get(es->attributes, attribute);
+}
 
-  value_checker_add_regex(vc, re, inverted);
+void element_sanitizer_intern(ElementSanitizer *es, xmlDictPtr names)
+{
+  Array *keys = dict_keys(es->attributes);
+  size_t i;
+
+  es->interned = name_index_new(es->arena, keys->size);
+  for (i = 0; i < keys->size; ++i)
+    name_index_set(es->interned, xmlDictLookup(names, BAD_CAST(keys->items[i]), -1),
+                   dict_get(es->attributes, keys->items[i]));
+  array_free(keys);
 }
 
-int element_sanitizer_is_valid(ElementSanitizer *es, const char *attribute, const char *value)
+ValueChecker *element_sanitizer_get_checker_interned(ElementSanitizer *es, const char *attribute)
 {
   ValueChecker *vc;
 
-  vc = dict_get(es->attributes, attribute);
-  return value_checker_check(vc, value);
+  if (es->interned && (vc = name_index_get(es->interned, attribute)))
+    return vc;
+  return dict_get(es->attributes, attribute);
+}
+
+int element_sanitizer_add_mandatory_attribute(ElementSanitizer *es, const char *attribute, const char *value)
+{
+  struct MandatoryAttribute *attributes;
+  size_t i;
+
+  for (i = 0; i < es->mandatory_attributes_count; ++i)
+    {
+      int cmp = strcmp(es->mandatory_attributes[i].name, attribute);
+      if (!cmp)
+        {
+          es->mandatory_attributes[i].value = arena_strdup(es->arena, value);
+          return 1;
+        }
+      if (cmp > 0)
+        break;
+    }
+  if (es->mandatory_attributes_count == ELEMENT_MAX_MANDATORY)
+    return 0;
+
+  /* a handful per element at most: the array is copied on every insertion */
+  attributes = arena_alloc(es->arena, (es->mandatory_attributes_count + 1) * sizeof(struct MandatoryAttribute));
+  if (es->mandatory_attributes_count)
+    {
+      memcpy(attributes, es->mandatory_attributes, i * sizeof(struct MandatoryAttribute));
+      memcpy(attributes + i + 1, es->mandatory_attributes + i,
+             (es->mandatory_attributes_count - i) * sizeof(struct MandatoryAttribute));
+    }
+  attributes[i].name = arena_strdup(es->arena, attribute);
+  attributes[i].value = arena_strdup(es->arena, value);
+
+  es->mandatory_attributes = attributes;
+  ++es->mandatory_attributes_count;
+  return 1;
 }
 
-void element_sanitizer_add_mandatory_attribute(ElementSanitizer *es, const char *attribute, const char *value)
+size_t element_sanitizer_get_mandatory_attributes(ElementSanitizer *es, const struct MandatoryAttribute **attributes)
 {
-  dict_replace(es->mandatory_attributes, attribute, strdup(value));
+  *attributes = es->mandatory_attributes;
+  return es->mandatory_attributes_count;
 }
 
-Dict *element_sanitizer_get_mandatory_attributes(ElementSanitizer *es)
+/* image */
+
+struct AttributeImage
 {
-  return es->mandatory_attributes;
+  image_offset name;
+  image_offset checker;
+};
+
+struct MandatoryImage
+{
+  image_offset name;
+  image_offset value;
+};
+
+struct ElementSanitizerImage
+{
+  uint32_t attribute_count;
+  image_offset attributes;      /* AttributeImage */
+  uint32_t mandatory_count;
+  image_offset mandatory;       /* MandatoryImage, sorted by name */
+};
+
+image_offset element_sanitizer_save(ElementSanitizer *es, ImageWriter *w)
+{
+  struct ElementSanitizerImage *image;
+  Array *keys;
+  image_offset offset, attributes, mandatory;
+  size_t i;
+
+  if ((offset = image_written(w, es)))
+    return offset;
+
+  keys = dict_keys(es->attributes);
+  attributes = image_reserve(w, keys->size * sizeof(struct AttributeImage));
+  for (i = 0; i < keys->size; ++i)
+    {
+      image_offset name = image_write_string(w, keys->items[i]);
+      image_offset checker = value_checker_save(dict_get(es->attributes, keys->items[i]), w);
+      struct AttributeImage *attribute = (struct AttributeImage *)image_record(w, attributes) + i;
+
+      attribute->name = name;
+      attribute->checker = checker;
+    }
+
+  mandatory = image_reserve(w, es->mandatory_attributes_count * sizeof(struct MandatoryImage));
+  for (i = 0; i < es->mandatory_attributes_count; ++i)
+    {
+      image_offset name = image_write_string(w, es->mandatory_attributes[i].name);
+      image_offset value = image_write_string(w, es->mandatory_attributes[i].value);
+      struct MandatoryImage *attribute = (struct MandatoryImage *)image_record(w, mandatory) + i;
+
+      attribute->name = name;
+      attribute->value = value;
+    }
+
+  offset = image_reserve(w, sizeof(struct ElementSanitizerImage));
+  image = image_record(w, offset);
+  image->attribute_count = keys->size;
+  image->attributes = attributes;
+  image->mandatory_count = es->mandatory_attributes_count;
+  image->mandatory = mandatory;
+  image_set_written(w, es, offset);
+
+  array_free(keys);
+  return offset;
+}
+
+ElementSanitizer *element_sanitizer_load(Arena *arena, CheckerPool *pool, ImageReader *r, image_offset offset)
+{
+  const struct ElementSanitizerImage *image = image_at(r, offset, sizeof(struct ElementSanitizerImage), 1);
+  const struct AttributeImage *attributes;
+  const struct MandatoryImage *mandatory;
+  ElementSanitizer *es;
+  size_t i;
+
+  if (!image)
+    return NULL;
+  if ((es = image_loaded(r, offset)))
+    return es;
+
+  attributes = image_at(r, image->attributes, sizeof(struct AttributeImage), image->attribute_count);
+  mandatory = image_at(r, image->mandatory, sizeof(struct MandatoryImage), image->mandatory_count);
+  if (!attributes || !mandatory || image->mandatory_count > ELEMENT_MAX_MANDATORY)
+    return NULL;
+
+  es = element_sanitizer_new(arena);
+  for (i = 0; i < image->attribute_count; ++i)
+    {
+      const char *name = image_string(r, attributes[i].name);
+      ValueChecker *vc = checker_pool_load(pool, r, attributes[i].checker);
+
+      if (!name || !vc)
+        return NULL;
+      element_sanitizer_set_checker(es, name, vc);
+    }
+
+  /* already sorted: the strings stay in the image */
+  es->mandatory_attributes = arena_alloc(arena, (image->mandatory_count + 1) * sizeof(struct MandatoryAttribute));
+  es->mandatory_attributes_count = image->mandatory_count;
+  for (i = 0; i < image->mandatory_count; ++i)
+    {
+      es->mandatory_attributes[i].name = (char *)image_string(r, mandatory[i].name);
+      es->mandatory_attributes[i].value = (char *)image_string(r, mandatory[i].value);
+      if (!es->mandatory_attributes[i].name || !es->mandatory_attributes[i].value)
+        return NULL;
+    }
+
+  image_set_loaded(r, offset, es);
+  return es;
 }
@@ -1,18 +1,45 @@
 #ifndef SANITIZE_ELEMENT_SANITIZER_H_INCLUDED
 #define SANITIZE_ELEMENT_SANITIZER_H_INCLUDED
 
+#include <libxml/xmlstring.h>
+#include <libxml/dict.h>
+#include "arena.h"
 #include "dict.h"
+#include "value_checker.h"
+#include "image.h"
 
 typedef struct ElementSanitizer ElementSanitizer;
 
-ElementSanitizer *element_sanitizer_new(void);
-void element_sanitizer_free(ElementSanitizer *es);
+struct MandatoryAttribute
+{
+  char *name;
+  char *value;
+};
 
-void element_sanitizer_add_regex(ElementSanitizer *es, const char *attribute, const char *re, int inverted);
-int element_sanitizer_is_valid(ElementSanitizer *es, const char *attribute, const char *value);
+/* everything in the arena, which the element sanitizer lives as long as */
+ElementSanitizer *element_sanitizer_new(Arena *arena);
 
-void element_sanitizer_add_mandatory_attribute(ElementSanitizer *es, const char *attribute, const char *value);
-Dict *element_sanitizer_get_mandatory_attributes(ElementSanitizer *es);
+/* vc belongs to the mode's checker pool */
+void element_sanitizer_set_checker(ElementSanitizer *es, const char *attribute, ValueChecker *vc);
+int element_sanitizer_is_valid(ElementSanitizer *es, const char *attribute, const char *value, struct StatsTally *tally);
+/* NULL when the attribute is not allowed, whatever its value */
+ValueChecker *element_sanitizer_get_checker(ElementSanitizer *es, const char *attribute);
+
+/* attribute names interned in names are then found by address, as tag_table_lookup_interned() */
+void element_sanitizer_intern(ElementSanitizer *es, xmlDictPtr names);
+ValueChecker *element_sanitizer_get_checker_interned(ElementSanitizer *es, const char *attribute);
+
+/* the engines keep track of them in a 64-bit mask */
+#define ELEMENT_MAX_MANDATORY (64)
+
+/* 0 when the element has ELEMENT_MAX_MANDATORY already */
+int element_sanitizer_add_mandatory_attribute(ElementSanitizer *es, const char *attribute, const char *value);
+/* sorted by name */
+size_t element_sanitizer_get_mandatory_attributes(ElementSanitizer *es, const struct MandatoryAttribute **attributes);
+
+/* NULL for a malformed image; strings of the loaded sanitizer may point into the image */
+image_offset element_sanitizer_save(ElementSanitizer *es, ImageWriter *w);
+ElementSanitizer *element_sanitizer_load(Arena *arena, CheckerPool *pool, ImageReader *r, image_offset offset);
 
 #endif
 
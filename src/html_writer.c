@@ -0,0 +1,343 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <libxml/HTMLtree.h>
+#include <libxml/parserInternals.h>
+
+#include "html_writer.h"
+
+int html_is_raw_text_element(const char *name)
+{
+  return name && (!strcasecmp(name, "script") || !strcasecmp(name, "style"));
+}
+
+/* xmlEncodeEntitiesReentrant() / xmlEncodeAttributeEntities() for an HTML document */
+static void encode_entities(Buffer *out, const unsigned char *cur, size_t len, int attr)
+{
+  const unsigned char *end = cur + len;
+  const unsigned char *plain = cur;
+
+  buffer_reserve(out, len);
+
+  for (; cur < end; ++cur)
+    {
+      const unsigned char c = *cur;
+      const char *replacement;
+
+      if ((c >= 0x20 && c != '<' && c != '>' && c != '&') || c == '\n' || c == '\t' || c == '\r')
+        continue;
+
+      buffer_append(out, (const char *)plain, cur - plain);
+      plain = cur + 1;
+
+      if (c == '&' && attr && cur + 1 < end && cur[1] == '{' &&
+          memchr(cur, '}', end - cur))
+        {
+          /* HTML 4 &{script} construct is kept as is */
+          const unsigned char *close = memchr(cur, '}', end - cur);
+          buffer_append(out, (const char *)cur, close - cur + 1);
+          cur = close;
+          plain = cur + 1;
+          continue;
+        }
+
+      switch (c)
+        {
+        case '<': replacement = "&lt;"; break;
+        case '>': replacement = "&gt;"; break;
+        case '&': replacement = "&amp;"; break;
+        default:  replacement = "";     break; /* other control characters are dropped */
+        }
+      buffer_append_string(out, replacement);
+    }
+
+  buffer_append(out, (const char *)plain, cur - plain);
+}
+
+void html_write_text(Buffer *out, const char *text, size_t len, int raw)
+{
+  if (raw)
+    buffer_append(out, text, len);
+  else
+    encode_entities(out, (const unsigned char *)text, len, 0);
+}
+
+void html_write_comment(Buffer *out, const char *content, size_t len)
+{
+  buffer_append(out, "<!--", 4);
+  buffer_append(out, content, len);
+  buffer_append(out, "-->", 3);
+}
+
+/* xmlBufWriteQuotedString() */
+static void write_quoted(Buffer *out, const char *value, size_t len)
+{
+  if (!memchr(value, '"', len))
+    {
+      buffer_append_char(out, '"');
+      buffer_append(out, value, len);
+      buffer_append_char(out, '"');
+    }
+  else if (!memchr(value, '\'', len))
+    {
+      buffer_append_char(out, '\'');
+      buffer_append(out, value, len);
+      buffer_append_char(out, '\'');
+    }
+  else
+    {
+      size_t i;
+      buffer_append_char(out, '"');
+      for (i = 0; i < len; ++i)
+        if (value[i] == '"')
+          buffer_append(out, "&quot;", 6);
+        else
+          buffer_append_char(out, value[i]);
+      buffer_append_char(out, '"');
+    }
+}
+
+static int is_uri_attribute(const char *element, const char *name)
+{
+  return !strcasecmp(name, "href") ||
+    !strcasecmp(name, "action") ||
+    !strcasecmp(name, "src") ||
+    (!strcasecmp(name, "name") && element && !strcasecmp(element, "a"));
+}
+
+static int is_blank(unsigned char c)
+{
+  return c == 0x20 || c == 0x9 || c == 0xA || c == 0xD;
+}
+
+/* xmlURIEscapeStr() with the reserved set htmlAttrDumpOutput() passes */
+static int uri_escape(Buffer *out, const unsigned char *value, size_t len)
+{
+  static const char HEX[] = "0123456789ABCDEF";
+  size_t i;
+
+  if (!len)
+    return 0;
+
+  buffer_reserve(out, len);
+  for (i = 0; i < len; ++i)
+    {
+      const unsigned char c = value[i];
+      if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+          strchr("-_.!~*'()@/:=?;#%&,+<>", c))
+        {
+          buffer_append_char(out, c);
+        }
+      else
+        {
+          buffer_append_char(out, '%');
+          buffer_append_char(out, HEX[c >> 4]);
+          buffer_append_char(out, HEX[c & 15]);
+        }
+    }
+  return 1;
+}
+
+static int needs_encoding(const unsigned char *value, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; ++i)
+    if (value[i] < 0x20 || value[i] == '<' || value[i] == '>' || value[i] == '&')
+      return 1;
+  return 0;
+}
+
+static int needs_uri_escape(const unsigned char *value, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; ++i)
+    {
+      const unsigned char c = value[i];
+      if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+            strchr("-_.!~*'()@/:=?;#%&,+<>", c)))
+        return 1;
+    }
+  return 0;
+}
+
+void html_write_attribute(Buffer *out, const char *element, const char *name, const char *value)
+{
+  Buffer encoded, escaped;
+  const char *text;
+  size_t len;
+
+  buffer_append_char(out, ' ');
+  buffer_append_string(out, name);
+
+  if (!value || htmlIsBooleanAttr(BAD_CAST(name)))
+    return;
+
+  buffer_append_char(out, '=');
+
+  /* most values need neither encoding nor escaping, and are written as they are */
+  buffer_init(&encoded);
+  buffer_init(&escaped);
+  text = value;
+  len = strlen(value);
+  if (needs_encoding((const unsigned char *)value, len))
+    {
+      encode_entities(&encoded, (const unsigned char *)value, len, 1);
+      text = encoded.data;
+      len = encoded.length;
+    }
+
+  if (is_uri_attribute(element, name))
+    {
+      size_t skip = 0;
+
+      while (skip < len && is_blank(text[skip]))
+        ++skip;
+
+      if (skip == len)
+        write_quoted(out, text, len);
+      else if (needs_uri_escape((const unsigned char *)text + skip, len - skip))
+        {
+          uri_escape(&escaped, (const unsigned char *)text + skip, len - skip);
+          write_quoted(out, escaped.data, escaped.length);
+        }
+      else
+        write_quoted(out, text + skip, len - skip);
+    }
+  else
+    {
+      write_quoted(out, text, len);
+    }
+
+  buffer_destroy(&escaped);
+  buffer_destroy(&encoded);
+}
+
+/* htmlNodeDumpFormatOutput() with format on, for the nodes a cleaned fragment holds */
+
+static void write_start_tag(Buffer *out, xmlNodePtr element)
+{
+  xmlAttrPtr attr;
+
+  buffer_append_char(out, '<');
+  buffer_append_string(out, (const char *)element->name);
+
+  for (attr = element->properties; attr; attr = attr->next)
+    {
+      xmlNodePtr child = attr->children;
+
+      if (!child)
+        html_write_attribute(out, (const char *)element->name, (const char *)attr->name, NULL);
+      else if (!child->next && child->type == XML_TEXT_NODE)
+        html_write_attribute(out, (const char *)element->name, (const char *)attr->name,
+                             child->content ? (const char *)child->content : "");
+      else
+        {
+          xmlChar *value = xmlNodeListGetString(element->doc, child, 1);
+          html_write_attribute(out, (const char *)element->name, (const char *)attr->name,
+                               value ? (const char *)value : "");
+          xmlFree(value);
+        }
+    }
+}
+
+static int is_text(xmlNodePtr node)
+{
+  return node->type == XML_TEXT_NODE || node->type == XML_ENTITY_REF_NODE;
+}
+
+/* no newlines inside p, pre and param, nor at the top level */
+static int allows_newlines(xmlNodePtr parent)
+{
+  return parent && parent->name && parent->name[0] != 'p';
+}
+
+static void write_newline_after(Buffer *out, xmlNodePtr element, const htmlElemDesc *info)
+{
+  if (info && !info->isinline && element->next && !is_text(element->next) &&
+      allows_newlines(element->parent))
+    buffer_append_char(out, '\n');
+}
+
+void html_write_node(Buffer *out, xmlNodePtr root)
+{
+  xmlNodePtr node = root;
+  const htmlElemDesc *info;
+
+  for (;;)
+    {
+      switch (node->type)
+        {
+        case XML_ELEMENT_NODE:
+          info = htmlTagLookup(node->name);
+          write_start_tag(out, node);
+
+          if (info && info->empty)
+            buffer_append_char(out, '>');
+          else if (!node->children)
+            {
+              if (info && info->saveEndTag &&
+                  strcmp(info->name, "html") && strcmp(info->name, "body"))
+                buffer_append_char(out, '>');
+              else
+                {
+                  buffer_append(out, "></", 3);
+                  buffer_append_string(out, (const char *)node->name);
+                  buffer_append_char(out, '>');
+                }
+            }
+          else
+            {
+              buffer_append_char(out, '>');
+              if (info && !info->isinline && !is_text(node->children) &&
+                  node->children != node->last && node->name[0] != 'p')
+                buffer_append_char(out, '\n');
+              node = node->children;
+              continue;
+            }
+
+          write_newline_after(out, node, info);
+          break;
+
+        case XML_TEXT_NODE:
+          if (node->content)
+            html_write_text(out, (const char *)node->content, strlen((const char *)node->content),
+                            node->name == xmlStringTextNoenc ||
+                            (node->parent && html_is_raw_text_element((const char *)node->parent->name)));
+          break;
+
+        case XML_COMMENT_NODE:
+          if (node->content)
+            html_write_comment(out, (const char *)node->content, strlen((const char *)node->content));
+          break;
+
+        default:
+          break;
+        }
+
+      /* next sibling, or close the elements finished on the way up */
+      for (;;)
+        {
+          if (node == root)
+            return;
+          if (node->next)
+            {
+              node = node->next;
+              break;
+            }
+
+          node = node->parent;
+          info = htmlTagLookup(node->name);
+
+          if (info && !info->isinline && !is_text(node->last) &&
+              node->children != node->last && node->name[0] != 'p')
+            buffer_append_char(out, '\n');
+          buffer_append(out, "</", 2);
+          buffer_append_string(out, (const char *)node->name);
+          buffer_append_char(out, '>');
+
+          write_newline_after(out, node, info);
+        }
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef SANITIZE_HTML_WRITER_H_INCLUDED
+#define SANITIZE_HTML_WRITER_H_INCLUDED
+
+#include <stddef.h>
+#include <libxml/tree.h>
+#include "buffer.h"
+
+/*
+ * Serialization primitives producing exactly what libxml2's
+ * htmlNodeDumpOutput() writes for UTF-8 output.
+ */
+
+int html_is_raw_text_element(const char *name);
+
+/* text content; raw is set for the children of script and style */
+void html_write_text(Buffer *out, const char *text, size_t len, int raw);
+void html_write_comment(Buffer *out, const char *content, size_t len);
+
+/* " name=value"; value is NULL for an attribute without a value */
+void html_write_attribute(Buffer *out, const char *element, const char *name, const char *value);
+
+/* root and its subtree, as htmlNodeDumpOutput() writes them */
+void html_write_node(Buffer *out, xmlNodePtr root);
+
+#endif
@@ -0,0 +1,88 @@
+#include <string.h>
+
+#include "image.h"
+
+void image_writer_init(ImageWriter *w)
+{
+  buffer_init(&w->data);
+  w->arena = arena_new();
+  w->written = name_index_new(w->arena, 64);
+}
+
+void image_writer_destroy(ImageWriter *w)
+{
+  buffer_destroy(&w->data);
+  arena_free(w->arena);
+}
+
+image_offset image_reserve(ImageWriter *w, size_t size)
+{
+  const size_t offset = (w->data.length + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+
+  buffer_reserve(&w->data, offset - w->data.length + size);
+  memset(w->data.data + w->data.length, 0, offset - w->data.length + size);
+  w->data.length = offset + size;
+  return (image_offset)offset;
+}
+
+image_offset image_write(ImageWriter *w, const void *data, size_t size)
+{
+  image_offset offset = image_reserve(w, size);
+
+  if (size)
+    memcpy(image_record(w, offset), data, size);
+  return offset;
+}
+
+image_offset image_write_string(ImageWriter *w, const char *str)
+{
+  return str ? image_write(w, str, strlen(str) + 1) : 0;
+}
+
+image_offset image_written(ImageWriter *w, const void *object)
+{
+  return (image_offset)(uintptr_t)name_index_get(w->written, object);
+}
+
+void image_set_written(ImageWriter *w, const void *object, image_offset offset)
+{
+  name_index_set(w->written, object, (void *)(uintptr_t)offset);
+}
+
+void image_reader_init(ImageReader *r, const void *data, size_t size)
+{
+  r->data = data;
+  r->size = size;
+  r->scratch = arena_new();
+  r->loaded = name_index_new(r->scratch, 64);
+}
+
+void image_reader_destroy(ImageReader *r)
+{
+  arena_free(r->scratch);
+}
+
+const void *image_at(const ImageReader *r, image_offset offset, size_t size, size_t count)
+{
+  if (offset % IMAGE_ALIGNMENT || offset > r->size ||
+      (size && count > (r->size - offset) / size))
+    return NULL;
+  return r->data + offset;
+}
+
+const char *image_string(const ImageReader *r, image_offset offset)
+{
+  if (!offset || offset >= r->size || !memchr(r->data + offset, '\0', r->size - offset))
+    return NULL;
+  return r->data + offset;
+}
+
+void *image_loaded(const ImageReader *r, image_offset offset)
+{
+  return name_index_get(r->loaded, r->data + offset);
+}
+
+void image_set_loaded(ImageReader *r, image_offset offset, void *object)
+{
+  name_index_set(r->loaded, r->data + offset, object);
+}
@@ -0,0 +1,69 @@
+#ifndef SANITIZE_IMAGE_H_INCLUDED
+#define SANITIZE_IMAGE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "buffer.h"
+#include "name_index.h"
+
+/*
+ * Flat, position-independent image of a compiled mode. Records refer to
+ * one another by their offset from the start of the image; offset 0 is
+ * the header, so it also stands for "none". Records are 8-byte aligned,
+ * and tables are stored exactly as the code reads them: a mapped image
+ * is used in place, and shared by every process that maps it.
+ */
+
+typedef uint32_t image_offset;
+
+#define IMAGE_ALIGNMENT (8)
+
+typedef struct ImageWriter ImageWriter;
+
+struct ImageWriter
+{
+  Buffer data;
+  Arena *arena;
+  NameIndex *written;           /* object --> offset of its record */
+};
+
+void image_writer_init(ImageWriter *w);
+void image_writer_destroy(ImageWriter *w);
+
+/* a zeroed record; pointers to earlier records are invalidated */
+image_offset image_reserve(ImageWriter *w, size_t size);
+image_offset image_write(ImageWriter *w, const void *data, size_t size);
+image_offset image_write_string(ImageWriter *w, const char *str);
+
+static inline void *image_record(ImageWriter *w, image_offset offset)
+{
+  return w->data.data + offset;
+}
+
+/* objects written once, whatever refers to them */
+image_offset image_written(ImageWriter *w, const void *object);
+void image_set_written(ImageWriter *w, const void *object, image_offset offset);
+
+typedef struct ImageReader ImageReader;
+
+struct ImageReader
+{
+  const char *data;
+  size_t size;
+  Arena *scratch;
+  NameIndex *loaded;            /* record --> object built from it */
+};
+
+void image_reader_init(ImageReader *r, const void *data, size_t size);
+void image_reader_destroy(ImageReader *r);
+
+/* NULL unless count records of size bytes are inside the image */
+const void *image_at(const ImageReader *r, image_offset offset, size_t size, size_t count);
+/* NULL unless a NUL-terminated string starts at offset */
+const char *image_string(const ImageReader *r, image_offset offset);
+
+void *image_loaded(const ImageReader *r, image_offset offset);
+void image_set_loaded(ImageReader *r, image_offset offset, void *object);
+
+#endif
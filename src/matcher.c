@@ -0,0 +1,880 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "matcher.h"
+#include "array.h"
+#include "image.h"
+
+/*
+ * Patterns are parsed into a small syntax tree, compiled into one
+ * Thompson NFA with a MATCH state per pattern, and then determinized
+ * eagerly over byte equivalence classes. The automaton is immutable
+ * once built, so it can be shared between threads without locking.
+ *
+ * Search semantics are implemented by re-injecting the pattern starts
+ * at every position; '^' only holds before the first byte and '$' only
+ * after the last one, as with regexec() without REG_NEWLINE.
+ */
+
+#define MAX_REPEAT (255)
+#define MAX_NFA_STATES (16384)
+#define MAX_DFA_STATES (4096)
+
+/* syntax tree */
+
+enum node_type
+{
+  RE_SET,
+  RE_EMPTY,
+  RE_BOL,
+  RE_EOL,
+  RE_CAT,
+  RE_ALT,
+  RE_REPEAT
+};
+
+struct Node
+{
+  enum node_type type;
+  struct Node *left, *right;
+  int min, max;                 /* RE_REPEAT, max < 0 is unbounded */
+  unsigned set[8];              /* RE_SET */
+};
+
+struct Parser
+{
+  const unsigned char *p;
+  int depth;
+  int unsupported;
+  Array *nodes;                 /* owns every node */
+};
+
+static void set_add(unsigned *set, unsigned c)
+{
+  set[c >> 5] |= 1u << (c & 31);
+}
+
+static int set_has(const unsigned *set, unsigned c)
+{
+  return (set[c >> 5] >> (c & 31)) & 1;
+}
+
+static void set_fold_case(unsigned *set)
+{
+  unsigned c;
+  for (c = 'a'; c <= 'z'; ++c)
+    if (set_has(set, c) || set_has(set, c - 'a' + 'A'))
+      {
+        set_add(set, c);
+        set_add(set, c - 'a' + 'A');
+      }
+}
+
+static int is_letter(unsigned c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+/* glibc folds ranges reaching over letters its own way: take those without letters or of one case only */
+static int range_folds(unsigned first, unsigned last)
+{
+  if ((first >= 'a' && last <= 'z') || (first >= 'A' && last <= 'Z'))
+    return 1;
+  return last < 'A' || first > 'z' || (first > 'Z' && last < 'a');
+}
+
+static struct Node *node_new(struct Parser *ps, enum node_type type, struct Node *left, struct Node *right)
+{
+  struct Node *node = calloc(1, sizeof(struct Node));
+  node->type = type;
+  node->left = left;
+  node->right = right;
+  array_append(ps->nodes, node);
+  return node;
+}
+
+/* character classes of the C locale */
+static int class_has(const char *name, size_t len, unsigned c)
+{
+#define IS(n) (len == sizeof(n) - 1 && !memcmp(name, n, len))
+  const int upper = c >= 'A' && c <= 'Z';
+  const int lower = c >= 'a' && c <= 'z';
+  const int digit = c >= '0' && c <= '9';
+  const int graph = c > 0x20 && c < 0x7f;
+
+  if (IS("alpha"))  return upper || lower;
+  if (IS("digit"))  return digit;
+  if (IS("alnum"))  return upper || lower || digit;
+  if (IS("upper"))  return upper;
+  if (IS("lower"))  return lower;
+  if (IS("space"))  return c == ' ' || (c >= '\t' && c <= '\r');
+  if (IS("blank"))  return c == ' ' || c == '\t';
+  if (IS("punct"))  return graph && !upper && !lower && !digit;
+  if (IS("print"))  return graph || c == ' ';
+  if (IS("graph"))  return graph;
+  if (IS("cntrl"))  return c < 0x20 || c == 0x7f;
+  if (IS("xdigit")) return digit || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+  return -1;
+#undef IS
+}
+
+static struct Node *parse_bracket(struct Parser *ps)
+{
+  struct Node *node = node_new(ps, RE_SET, NULL, NULL);
+  int negate = 0, first = 1;
+  unsigned c;
+
+  if (*ps->p == '^')
+    {
+      negate = 1;
+      ++ps->p;
+    }
+
+  for (;;)
+    {
+      c = *ps->p;
+      if (!c)
+        {
+          ps->unsupported = 1;
+          return node;
+        }
+      if (c == ']' && !first)
+        {
+          ++ps->p;
+          break;
+        }
+      first = 0;
+
+      if (c == '[' && ps->p[1] == ':')
+        {
+          const char *name = (const char *)ps->p + 2;
+          const char *end = strstr(name, ":]");
+          unsigned b;
+
+          if (!end || class_has(name, end - name, 0) < 0)
+            {
+              ps->unsupported = 1;
+              return node;
+            }
+          for (b = 1; b < 256; ++b)
+            if (class_has(name, end - name, b))
+              set_add(node->set, b);
+          ps->p = (const unsigned char *)end + 2;
+          continue;
+        }
+      if (c == '[' && (ps->p[1] == '.' || ps->p[1] == '='))
+        {
+          ps->unsupported = 1;  /* collating elements and equivalence classes */
+          return node;
+        }
+
+      ++ps->p;
+      if (*ps->p == '-' && ps->p[1] && ps->p[1] != ']')
+        {
+          unsigned last = ps->p[1], b;
+          if (last < c || !range_folds(c, last) ||
+              (last == '[' && (ps->p[2] == '.' || ps->p[2] == '=' || ps->p[2] == ':')))
+            {
+              ps->unsupported = 1;
+              return node;
+            }
+          for (b = c; b <= last; ++b)
+            set_add(node->set, b);
+          ps->p += 2;
+        }
+      else
+        {
+          set_add(node->set, c);
+        }
+    }
+
+  set_fold_case(node->set);
+  if (negate)
+    {
+      unsigned i;
+      for (i = 0; i < 8; ++i)
+        node->set[i] = ~node->set[i];
+    }
+  node->set[0] &= ~1u;          /* NUL never occurs in a value */
+  return node;
+}
+
+static int parse_number(struct Parser *ps, int *number)
+{
+  int n = 0, digits = 0;
+  while (*ps->p >= '0' && *ps->p <= '9' && n <= MAX_REPEAT)
+    {
+      n = n * 10 + (*ps->p++ - '0');
+      ++digits;
+    }
+  *number = n;
+  return digits;
+}
+
+static struct Node *parse_alternation(struct Parser *ps);
+
+static struct Node *parse_atom(struct Parser *ps)
+{
+  struct Node *node;
+  unsigned c = *ps->p++;
+
+  switch (c)
+    {
+    case '(':
+      ++ps->depth;
+      node = parse_alternation(ps);
+      --ps->depth;
+      if (*ps->p != ')')
+        ps->unsupported = 1;
+      else
+        ++ps->p;
+      return node;
+
+    case '.':
+      node = node_new(ps, RE_SET, NULL, NULL);
+      memset(node->set, 0xff, sizeof(node->set));
+      node->set[0] &= ~1u;
+      return node;
+
+    case '[':
+      return parse_bracket(ps);
+
+    case '^':
+      return node_new(ps, RE_BOL, NULL, NULL);
+
+    case '$':
+      return node_new(ps, RE_EOL, NULL, NULL);
+
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+    case ')':
+      ps->unsupported = 1;
+      return node_new(ps, RE_EMPTY, NULL, NULL);
+
+    case '\\':
+      c = *ps->p++;
+      if (!c || is_letter(c) || (c >= '0' && c <= '9') || strchr("<>`'", c))
+        {
+          ps->unsupported = 1;  /* GNU extensions, back-references and escapes of its own */
+          if (!c)
+            --ps->p;
+          return node_new(ps, RE_EMPTY, NULL, NULL);
+        }
+      /* fall through */
+
+    default:
+      node = node_new(ps, RE_SET, NULL, NULL);
+      set_add(node->set, c);
+      set_fold_case(node->set);
+      return node;
+    }
+}
+
+static int has_anchor(const struct Node *node)
+{
+  if (!node)
+    return 0;
+  if (node->type == RE_BOL || node->type == RE_EOL)
+    return 1;
+  return has_anchor(node->left) || has_anchor(node->right);
+}
+
+static struct Node *parse_repeat(struct Parser *ps, struct Node *atom)
+{
+  for (;;)
+    {
+      struct Node *node;
+      int min, max;
+
+      switch (*ps->p)
+        {
+        case '*': min = 0; max = -1; ++ps->p; break;
+        case '+': min = 1; max = -1; ++ps->p; break;
+        case '?': min = 0; max = 1;  ++ps->p; break;
+        case '{':
+          ++ps->p;
+          parse_number(ps, &min);
+          max = min;
+          if (*ps->p == ',')
+            {
+              ++ps->p;
+              if (!parse_number(ps, &max))
+                max = -1;
+            }
+          if (*ps->p != '}' || min > MAX_REPEAT || max > MAX_REPEAT || (max >= 0 && max < min))
+            {
+              ps->unsupported = 1;
+              return atom;
+            }
+          ++ps->p;
+          break;
+        default:
+          return atom;
+        }
+
+      if (has_anchor(atom))
+        {
+          ps->unsupported = 1;  /* glibc disagrees with POSIX on repeated anchors */
+          return atom;
+        }
+
+      node = node_new(ps, RE_REPEAT, atom, NULL);
+      node->min = min;
+      node->max = max;
+      atom = node;
+    }
+}
+
+static struct Node *parse_concatenation(struct Parser *ps)
+{
+  struct Node *result = NULL;
+
+  while (*ps->p && *ps->p != '|' && !(*ps->p == ')' && ps->depth > 0) && !ps->unsupported)
+    {
+      struct Node *node = parse_repeat(ps, parse_atom(ps));
+      result = result ? node_new(ps, RE_CAT, result, node) : node;
+    }
+
+  return result ? result : node_new(ps, RE_EMPTY, NULL, NULL);
+}
+
+static struct Node *parse_alternation(struct Parser *ps)
+{
+  struct Node *result = parse_concatenation(ps);
+
+  while (*ps->p == '|' && !ps->unsupported)
+    {
+      ++ps->p;
+      result = node_new(ps, RE_ALT, result, parse_concatenation(ps));
+    }
+
+  return result;
+}
+
+/* NFA */
+
+enum nfa_type
+{
+  NS_SET,
+  NS_SPLIT,
+  NS_BOL,
+  NS_EOL,
+  NS_MATCH
+};
+
+struct NState
+{
+  enum nfa_type type;
+  int out, out1;
+  const unsigned *set;          /* NS_SET */
+  unsigned pattern;             /* NS_MATCH */
+};
+
+struct Nfa
+{
+  struct NState *states;
+  int count;
+  int allocated;
+  int overflow;
+};
+
+static int nfa_add(struct Nfa *nfa, enum nfa_type type, int out, int out1)
+{
+  struct NState *st;
+
+  if (nfa->count >= MAX_NFA_STATES)
+    {
+      nfa->overflow = 1;
+      return 0;
+    }
+  if (nfa->count == nfa->allocated)
+    {
+      nfa->allocated = nfa->allocated ? nfa->allocated * 2 : 64;
+      nfa->states = realloc(nfa->states, nfa->allocated * sizeof(struct NState));
+    }
+  st = &nfa->states[nfa->count];
+  st->type = type;
+  st->out = out;
+  st->out1 = out1;
+  st->set = NULL;
+  st->pattern = 0;
+  return nfa->count++;
+}
+
+/* builds the automaton for node followed by state next, returns its entry */
+static int nfa_compile(struct Nfa *nfa, const struct Node *node, int next)
+{
+  int s, i;
+
+  if (nfa->overflow)
+    return next;
+
+  switch (node->type)
+    {
+    case RE_SET:
+      s = nfa_add(nfa, NS_SET, next, -1);
+      nfa->states[s].set = node->set;
+      return s;
+
+    case RE_EMPTY:
+      return next;
+
+    case RE_BOL:
+      return nfa_add(nfa, NS_BOL, next, -1);
+
+    case RE_EOL:
+      return nfa_add(nfa, NS_EOL, next, -1);
+
+    case RE_CAT:
+      return nfa_compile(nfa, node->left, nfa_compile(nfa, node->right, next));
+
+    case RE_ALT:
+      {
+        int left = nfa_compile(nfa, node->left, next);
+        int right = nfa_compile(nfa, node->right, next);
+        return nfa_add(nfa, NS_SPLIT, left, right);
+      }
+
+    case RE_REPEAT:
+      if (node->max < 0)
+        {
+          int loop = nfa_add(nfa, NS_SPLIT, -1, next);
+          s = nfa_compile(nfa, node->left, loop);
+          if (!nfa->overflow)
+            nfa->states[loop].out = s;
+          s = loop;
+        }
+      else
+        {
+          s = next;
+          for (i = node->min; i < node->max; ++i)
+            s = nfa_add(nfa, NS_SPLIT, nfa_compile(nfa, node->left, s), next);
+        }
+      for (i = 0; i < node->min; ++i)
+        s = nfa_compile(nfa, node->left, s);
+      return s;
+    }
+
+  return next;
+}
+
+/* determinization */
+
+struct Closure
+{
+  int *sets;                    /* NS_SET states reached, sorted */
+  int count;
+  unsigned accept;
+};
+
+struct Builder
+{
+  const struct Nfa *nfa;
+  const int *starts;
+  int start_count;
+  unsigned *mark;
+  unsigned generation;
+  int *stack;
+
+  /* DFA states are identified by their kernel: NFA states entered plus the '^' flag */
+  Array *kernels;               /* int[]: bol, count, states... */
+  int *table;                   /* open addressing over kernels, -1 is empty */
+  unsigned table_size;
+};
+
+static void closure(struct Builder *b, const int *kernel, int count, int bol, int eol, struct Closure *out)
+{
+  int top = 0, i;
+
+  ++b->generation;
+  out->count = 0;
+  out->accept = 0;
+
+  for (i = 0; i < count; ++i)
+    b->stack[top++] = kernel[i];
+
+  while (top)
+    {
+      int s = b->stack[--top];
+      const struct NState *st;
+
+      if (s < 0 || b->mark[s] == b->generation)
+        continue;
+      b->mark[s] = b->generation;
+      st = &b->nfa->states[s];
+
+      switch (st->type)
+        {
+        case NS_SET:
+          out->sets[out->count++] = s;
+          break;
+        case NS_SPLIT:
+          b->stack[top++] = st->out1;
+          b->stack[top++] = st->out;
+          break;
+        case NS_BOL:
+          if (bol)
+            b->stack[top++] = st->out;
+          break;
+        case NS_EOL:
+          if (eol)
+            b->stack[top++] = st->out;
+          break;
+        case NS_MATCH:
+          out->accept |= 1u << st->pattern;
+          break;
+        }
+    }
+}
+
+static int int_less(const void *a, const void *b)
+{
+  const int x = *(const int *)a, y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+static unsigned kernel_hash(const int *kernel)
+{
+  unsigned hash = 2166136261u;
+  int i;
+  for (i = 0; i < kernel[1] + 2; ++i)
+    hash = (hash ^ (unsigned)kernel[i]) * 16777619u;
+  return hash;
+}
+
+/* returns the DFA state for kernel, adding it when new; -1 on overflow */
+static int builder_intern(struct Builder *b, int *kernel)
+{
+  unsigned slot = kernel_hash(kernel) & (b->table_size - 1);
+
+  while (b->table[slot] >= 0)
+    {
+      const int *other = b->kernels->items[b->table[slot]];
+      if (other[1] == kernel[1] && !memcmp(other, kernel, (kernel[1] + 2) * sizeof(int)))
+        {
+          free(kernel);
+          return b->table[slot];
+        }
+      slot = (slot + 1) & (b->table_size - 1);
+    }
+
+  if (b->kernels->size >= MAX_DFA_STATES)
+    {
+      free(kernel);
+      return -1;
+    }
+
+  b->table[slot] = b->kernels->size;
+  array_append(b->kernels, kernel);
+  return b->kernels->size - 1;
+}
+
+struct Matcher
+{
+  unsigned char classes[256];   /* byte --> equivalence class */
+  unsigned class_count;
+  unsigned state_count;
+  int *transitions;             /* state * class_count + class --> state */
+  unsigned *accept;             /* patterns matching at a position inside the value */
+  unsigned *accept_end;         /* patterns matching at the end of the value */
+  unsigned char *dead;          /* no further pattern can match */
+};
+
+static void compute_classes(Matcher *m, const struct Nfa *nfa, unsigned char *representatives)
+{
+  unsigned c, k;
+  int s;
+
+  m->class_count = 0;
+  for (c = 0; c < 256; ++c)
+    {
+      for (k = 0; k < m->class_count; ++k)
+        {
+          const unsigned r = representatives[k];
+          for (s = 0; s < nfa->count; ++s)
+            if (nfa->states[s].type == NS_SET &&
+                set_has(nfa->states[s].set, c) != set_has(nfa->states[s].set, r))
+              break;
+          if (s == nfa->count)
+            break;
+        }
+      if (k == m->class_count)
+        representatives[m->class_count++] = c;
+      m->classes[c] = k;
+    }
+}
+
+static int determinize(Matcher *m, const struct Nfa *nfa, const int *starts, int start_count)
+{
+  struct Builder b;
+  struct Closure cl;
+  unsigned char representatives[256];
+  int *kernel, *targets;
+  size_t allocated = 64;
+  unsigned state, k;
+  int ok = 1, i;
+
+  compute_classes(m, nfa, representatives);
+
+  b.nfa = nfa;
+  b.starts = starts;
+  b.start_count = start_count;
+  b.mark = calloc(nfa->count, sizeof(unsigned));
+  b.generation = 0;
+  b.stack = malloc((3 * nfa->count + start_count + 1) * sizeof(int));
+  b.kernels = array_new((free_function_t)free);
+  b.table_size = 2 * MAX_DFA_STATES;
+  b.table = malloc(b.table_size * sizeof(int));
+  memset(b.table, 0xff, b.table_size * sizeof(int));
+
+  cl.sets = malloc((nfa->count + 1) * sizeof(int));
+  targets = malloc((nfa->count + start_count + 1) * sizeof(int));
+
+  m->transitions = malloc(allocated * m->class_count * sizeof(int));
+  m->accept = malloc(allocated * sizeof(unsigned));
+  m->accept_end = malloc(allocated * sizeof(unsigned));
+
+  /* initial state: the pattern starts with '^' holding */
+  kernel = malloc((start_count + 2) * sizeof(int));
+  kernel[0] = 1;
+  kernel[1] = start_count;
+  memcpy(kernel + 2, starts, start_count * sizeof(int));
+  qsort(kernel + 2, start_count, sizeof(int), int_less);
+  builder_intern(&b, kernel);
+
+  for (state = 0; state < b.kernels->size && ok; ++state)
+    {
+      const int *current = b.kernels->items[state];
+
+      if (state == allocated)
+        {
+          allocated *= 2;
+          m->transitions = realloc(m->transitions, allocated * m->class_count * sizeof(int));
+          m->accept = realloc(m->accept, allocated * sizeof(unsigned));
+          m->accept_end = realloc(m->accept_end, allocated * sizeof(unsigned));
+        }
+
+      closure(&b, current + 2, current[1], current[0], 1, &cl);
+      m->accept_end[state] = cl.accept;
+      closure(&b, current + 2, current[1], current[0], 0, &cl);
+      m->accept[state] = cl.accept;
+
+      for (k = 0; k < m->class_count && ok; ++k)
+        {
+          const unsigned c = representatives[k];
+          int count = 0, unique = 0, target;
+
+          for (i = 0; i < cl.count; ++i)
+            if (set_has(nfa->states[cl.sets[i]].set, c))
+              targets[count++] = nfa->states[cl.sets[i]].out;
+          for (i = 0; i < start_count; ++i)
+            targets[count++] = starts[i];
+          qsort(targets, count, sizeof(int), int_less);
+
+          kernel = malloc((count + 2) * sizeof(int));
+          kernel[0] = 0;
+          for (i = 0; i < count; ++i)
+            if (!unique || kernel[2 + unique - 1] != targets[i])
+              kernel[2 + unique++] = targets[i];
+          kernel[1] = unique;
+
+          target = builder_intern(&b, kernel);
+          if (target < 0)
+            ok = 0;
+          m->transitions[state * m->class_count + k] = target;
+        }
+    }
+
+  m->state_count = b.kernels->size;
+  m->dead = malloc(m->state_count);
+  for (state = 0; state < m->state_count && ok; ++state)
+    {
+      int stuck = !m->accept[state] && !m->accept_end[state];
+      for (k = 0; k < m->class_count && stuck; ++k)
+        if (m->transitions[state * m->class_count + k] != (int)state)
+          stuck = 0;
+      m->dead[state] = stuck;
+    }
+
+  free(targets);
+  free(cl.sets);
+  free(b.table);
+  array_free(b.kernels);
+  free(b.stack);
+  free(b.mark);
+
+  return ok;
+}
+
+Matcher *matcher_compile(const char *const *patterns, size_t count)
+{
+  struct Parser ps;
+  struct Nfa nfa;
+  Matcher *m = NULL;
+  int *starts;
+  size_t i;
+  int ok = 1;
+
+  if (count > MATCHER_MAX_PATTERNS)
+    return NULL;
+
+  ps.nodes = array_new((free_function_t)free);
+  memset(&nfa, 0, sizeof(nfa));
+  starts = malloc((count + 1) * sizeof(int));
+
+  for (i = 0; i < count && ok; ++i)
+    {
+      struct Node *root;
+      int match;
+
+      ps.p = (const unsigned char *)patterns[i];
+      ps.depth = 0;
+      ps.unsupported = 0;
+      root = parse_alternation(&ps);
+      if (ps.unsupported || *ps.p)
+        {
+          ok = 0;
+          break;
+        }
+
+      match = nfa_add(&nfa, NS_MATCH, -1, -1);
+      nfa.states[match].pattern = i;
+      starts[i] = nfa_compile(&nfa, root, match);
+      if (nfa.overflow)
+        ok = 0;
+    }
+
+  if (ok)
+    {
+      m = calloc(1, sizeof(struct Matcher));
+      if (!determinize(m, &nfa, starts, count))
+        {
+          matcher_free(m);
+          m = NULL;
+        }
+    }
+
+  free(starts);
+  free(nfa.states);
+  array_free(ps.nodes);
+  return m;
+}
+
+Matcher *matcher_freeze(Matcher *m, Arena *arena)
+{
+  Matcher *copy = arena_alloc(arena, sizeof(struct Matcher));
+  const size_t states = m->state_count;
+
+  *copy = *m;
+  copy->transitions = arena_alloc(arena, states * m->class_count * sizeof(int));
+  memcpy(copy->transitions, m->transitions, states * m->class_count * sizeof(int));
+  copy->accept = arena_alloc(arena, states * sizeof(unsigned));
+  memcpy(copy->accept, m->accept, states * sizeof(unsigned));
+  copy->accept_end = arena_alloc(arena, states * sizeof(unsigned));
+  memcpy(copy->accept_end, m->accept_end, states * sizeof(unsigned));
+  copy->dead = arena_alloc(arena, states);
+  memcpy(copy->dead, m->dead, states);
+  matcher_free(m);
+  return copy;
+}
+
+/* the tables are written as they are, and used in place once loaded */
+
+struct MatcherImage
+{
+  unsigned char classes[256];
+  uint32_t class_count;
+  uint32_t state_count;
+  image_offset transitions;
+  image_offset accept;
+  image_offset accept_end;
+  image_offset dead;
+};
+
+image_offset matcher_save(const Matcher *m, ImageWriter *w)
+{
+  struct MatcherImage *image;
+  image_offset offset, transitions, accept, accept_end, dead;
+  const size_t states = m->state_count;
+
+  transitions = image_write(w, m->transitions, states * m->class_count * sizeof(int));
+  accept = image_write(w, m->accept, states * sizeof(unsigned));
+  accept_end = image_write(w, m->accept_end, states * sizeof(unsigned));
+  dead = image_write(w, m->dead, states);
+
+  offset = image_reserve(w, sizeof(struct MatcherImage));
+  image = image_record(w, offset);
+  memcpy(image->classes, m->classes, sizeof(m->classes));
+  image->class_count = m->class_count;
+  image->state_count = m->state_count;
+  image->transitions = transitions;
+  image->accept = accept;
+  image->accept_end = accept_end;
+  image->dead = dead;
+  return offset;
+}
+
+Matcher *matcher_load(Arena *arena, const ImageReader *r, image_offset offset)
+{
+  const struct MatcherImage *image = image_at(r, offset, sizeof(struct MatcherImage), 1);
+  const int *transitions;
+  Matcher *m;
+  size_t states, i;
+
+  if (!image || !image->class_count || image->class_count > 256 || !image->state_count ||
+      image->state_count > MAX_DFA_STATES)
+    return NULL;
+  states = image->state_count;
+  for (i = 0; i < 256; ++i)
+    if (image->classes[i] >= image->class_count)
+      return NULL;
+
+  transitions = image_at(r, image->transitions, sizeof(int), states * image->class_count);
+  if (!transitions)
+    return NULL;
+  for (i = 0; i < states * image->class_count; ++i)
+    if (transitions[i] < 0 || (size_t)transitions[i] >= states)
+      return NULL;
+
+  m = arena_alloc(arena, sizeof(struct Matcher));
+  memcpy(m->classes, image->classes, sizeof(m->classes));
+  m->class_count = image->class_count;
+  m->state_count = image->state_count;
+  m->transitions = (int *)transitions;
+  m->accept = (unsigned *)image_at(r, image->accept, sizeof(unsigned), states);
+  m->accept_end = (unsigned *)image_at(r, image->accept_end, sizeof(unsigned), states);
+  m->dead = (unsigned char *)image_at(r, image->dead, 1, states);
+  if (!m->accept || !m->accept_end || !m->dead)
+    return NULL;
+  return m;
+}
+
+void matcher_free(Matcher *m)
+{
+  if (!m)
+    return;
+  free(m->transitions);
+  free(m->accept);
+  free(m->accept_end);
+  free(m->dead);
+  free(m);
+}
+
+unsigned matcher_run(const Matcher *m, const char *value, unsigned stop_mask)
+{
+  const unsigned char *p = (const unsigned char *)value;
+  unsigned state = 0;
+  unsigned matched = m->accept[0];
+
+  for (; *p; ++p)
+    {
+      if ((matched & stop_mask) || m->dead[state])
+        return matched;
+      state = m->transitions[state * m->class_count + m->classes[*p]];
+      matched |= m->accept[state];
+    }
+
+  return matched | m->accept_end[state];
+}
@@ -0,0 +1,31 @@
+#ifndef SANITIZE_MATCHER_H_INCLUDED
+#define SANITIZE_MATCHER_H_INCLUDED
+
+#include <stddef.h>
+#include "arena.h"
+#include "image.h"
+
+/*
+ * A set of POSIX extended regular expressions (REG_ICASE, C locale,
+ * search semantics) compiled together into one deterministic automaton.
+ * One pass over the value tells which of the patterns match.
+ */
+
+#define MATCHER_MAX_PATTERNS (32)
+
+typedef struct Matcher Matcher;
+
+/* NULL when a pattern uses syntax the engine does not handle or the automaton grows too large */
+Matcher *matcher_compile(const char *const *patterns, size_t count);
+/* moves m into the arena, sized to fit; the copy is not passed to matcher_free() */
+Matcher *matcher_freeze(Matcher *m, Arena *arena);
+void matcher_free(Matcher *m);
+
+/* the loaded matcher reads its tables from the image, which has to outlive it */
+image_offset matcher_save(const Matcher *m, ImageWriter *w);
+Matcher *matcher_load(Arena *arena, const ImageReader *r, image_offset offset);
+
+/* bit i is set when pattern i matches; scanning stops as soon as a bit of stop_mask is set */
+unsigned matcher_run(const Matcher *m, const char *value, unsigned stop_mask);
+
+#endif
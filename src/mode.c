@@ -1,10 +1,18 @@
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 
 #include "mode.h"
+#include "image.h"
 
 const char *Q_WHITESPACE = NULL;
 
@@ -14,29 +22,132 @@ void mode_init_quarks(void)
     Q_WHITESPACE = quark("--whitespace--");
 }
 
+/* library */
+
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
+static int initialized = 0;
+
+void sanitize_init(void)
+{
+  pthread_mutex_lock(&init_lock);
+  if (!initialized)
+    {
+      xmlInitParser();
+      init_quarks();
+      mode_init_quarks();
+      initialized = 1;
+    }
+  pthread_mutex_unlock(&init_lock);
+}
+
+void sanitize_cleanup(void)
+{
+  pthread_mutex_lock(&init_lock);
+  if (initialized)
+    {
+      free_quarks();
+      Q_WHITESPACE = NULL;
+      xmlCleanupParser();
+      initialized = 0;
+    }
+  pthread_mutex_unlock(&init_lock);
+}
+
 struct sanitize_mode *mode_new(void)
 {
   struct sanitize_mode *mode;
+  Arena *arena;
 
-  mode_init_quarks();
+  sanitize_init();
 
-  mode = malloc(sizeof(struct sanitize_mode));
+  arena = arena_new();
+  mode = arena_alloc(arena, sizeof(struct sanitize_mode));
+  mode->arena = arena;
   mode->allow_comments = 0;
-  mode->elements = dict_new((free_function_t)element_sanitizer_free);
-  mode->delete_elements = dict_new(NULL);
-  mode->rename_elements = dict_new((free_function_t)qfree);
+  mode->elements = dict_new_in(arena);
+  mode->delete_elements = dict_new_in(arena);
+  mode->rename_elements = dict_new_in(arena);  /* values are quarks */
+  mode->tags = NULL;
+  mode->names = NULL;
+  mode->checkers = checker_pool_new(arena);
+  mode->image = NULL;
+  mode->image_size = 0;
+  mode->refs = 0;
+  mode->stats = stats_new(arena);
+  mode->tracer.trace = NULL;
+  mode->tracer.context = NULL;
+  memset(&mode->limits, 0, sizeof(mode->limits));
 
   return mode;
 }
 
+static void mode_intern_names(struct sanitize_mode *mode)
+{
+  Array *names;
+  size_t i;
+
+  /* parsers already running keep the old dictionary alive, and fall back to hashed lookups */
+  xmlDictFree(mode->names);
+  mode->names = xmlDictCreate();
+  tag_table_intern(mode->tags, mode->names);
+  names = dict_keys(mode->elements);
+  for (i = 0; i < names->size; ++i)
+    element_sanitizer_intern(dict_get(mode->elements, names->items[i]), mode->names);
+  array_free(names);
+}
+
+void mode_compile(struct sanitize_mode *mode)
+{
+  /* a table built before stays in the arena until the mode is freed */
+  mode->tags = tag_table_build(mode->arena, mode->elements, mode->delete_elements, mode->rename_elements);
+  mode_intern_names(mode);
+}
+
 void mode_free(struct sanitize_mode *mode)
 {
+  const void *image;
+  size_t image_size;
+
   if (!mode)
     return;
-  dict_free(mode->elements);
-  dict_free(mode->delete_elements);
-  dict_free(mode->rename_elements);
-  free(mode);
+  image = mode->image;
+  image_size = mode->image_size;
+  checker_pool_free(mode->checkers);
+  xmlDictFree(mode->names);
+  arena_free(mode->arena);     /* the mode itself included */
+  if (image)
+    munmap((void *)image, image_size);
+}
+
+size_t mode_memory_usage(const struct sanitize_mode *mode)
+{
+  return arena_size(mode->arena);
+}
+
+void mode_stats_snapshot(const struct sanitize_mode *mode, struct sanitize_stats *stats)
+{
+  stats_snapshot(mode->stats, stats);
+}
+
+unsigned long long mode_stats_tag(const struct sanitize_mode *mode, const char *name)
+{
+  return mode->tags ? tag_table_hits(mode->tags, name) : 0;
+}
+
+void mode_set_trace(struct sanitize_mode *mode, sanitize_trace_function trace, void *context)
+{
+  mode->tracer.trace = trace;
+  mode->tracer.context = context;
+}
+
+void mode_set_limits(struct sanitize_mode *mode, const struct sanitize_limits *limits)
+{
+  mode->limits = *limits;
+}
+
+void mode_get_limits(const struct sanitize_mode *mode, struct sanitize_limits *limits)
+{
+  *limits = mode->limits;
 }
 
 static const char *get_attribute_quark(xmlNode *node, const char *attr_name, const char *default_value)
@@ -69,39 +180,141 @@ static int str_ends_with(const char *string, const char *suffix)
   return string_length >= suffix_length && !strcmp(string + string_length - suffix_length, suffix);
 }
 
-static void mode_load_attributes(ElementSanitizer *element_sanitizer, xmlNode *node)
+/* attribute rules of a mode element: name="re", name.not="re" or name.set="value" */
+
+enum rule_kind
+{
+  RULE_MATCH,
+  RULE_NOT_MATCH,
+  RULE_SET
+};
+
+struct AttributeRule
+{
+  char *attribute;
+  xmlChar *value;
+  enum rule_kind kind;
+};
+
+static void free_attribute_rule(struct AttributeRule *rule)
+{
+  free(rule->attribute);
+  xmlFree(rule->value);
+  free(rule);
+}
+
+static void mode_parse_attributes(Array *rules, xmlNode *node)
 {
   xmlAttrPtr attr;
   for (attr = node->properties; attr; attr = attr->next)
     {
-      char *attribute;
+      struct AttributeRule *rule = malloc(sizeof(struct AttributeRule));
       size_t name_len;
-      xmlChar* value;
 
-      attribute = strdup((const char *)attr->name);
-      name_len = strlen(attribute);
-      value = xmlNodeListGetString(node->doc, attr->children, 1);
+      rule->attribute = strdup((const char *)attr->name);
+      rule->value = xmlNodeListGetString(node->doc, attr->children, 1);
+      rule->kind = RULE_MATCH;
+      name_len = strlen(rule->attribute);
+
+      if (str_ends_with(rule->attribute, ".set"))
+        {
+          rule->attribute[name_len - 4] = '\0';
+          rule->kind = RULE_SET;
+        }
+      else if (str_ends_with(rule->attribute, ".not"))
+        {
+          rule->attribute[name_len - 4] = '\0';
+          rule->kind = RULE_NOT_MATCH;
+        }
+
+      array_append(rules, rule);
+    }
+}
+
+/*
+ * Rules are applied in order; an empty pattern discards the attribute's
+ * earlier patterns. 0 for more mandatory attributes than an element takes.
+ */
+static int mode_apply_rules(ElementSanitizer *element_sanitizer, Dict *checks, Array *rules)
+{
+  size_t i;
+
+  for (i = 0; i < rules->size; ++i)
+    {
+      struct AttributeRule *rule = rules->items[i];
+      Array *list;
 
-      if (str_ends_with(attribute, ".set"))
+      if (rule->kind == RULE_SET)
         {
-          attribute[name_len - 4] = '\0';
-          element_sanitizer_add_mandatory_attribute(element_sanitizer, attribute, (const char *)value);
+          if (!element_sanitizer_add_mandatory_attribute(element_sanitizer, rule->attribute, (const char *)rule->value))
+            return 0;
+          continue;
         }
+
+      list = dict_get(checks, rule->attribute);
+      if (!list)
+        {
+          list = array_new(NULL);
+          dict_replace(checks, rule->attribute, list);
+        }
+
+      if (rule->value && *rule->value)
+        array_append(list, rule);
       else
+        array_clean(list);
+    }
+  return 1;
+}
+
+static ElementSanitizer *mode_build_element_sanitizer(struct sanitize_mode *mode, Array *common_rules, Array *rules)
+{
+  ElementSanitizer *element_sanitizer = element_sanitizer_new(mode->arena);
+  Dict *checks = dict_new((free_function_t)array_free);    /* attr name --> rules */
+  Array *attributes;
+  size_t i, j;
+
+  if (!mode_apply_rules(element_sanitizer, checks, common_rules) ||
+      !mode_apply_rules(element_sanitizer, checks, rules))
+    {
+      dict_free(checks);
+      return NULL;
+    }
+
+  attributes = dict_keys(checks);
+  for (i = 0; i < attributes->size; ++i)
+    {
+      Array *list = dict_get(checks, attributes->items[i]);
+      const char **res = malloc((list->size + 1) * sizeof(char *));
+      int *inverted = malloc((list->size + 1) * sizeof(int));
+
+      for (j = 0; j < list->size; ++j)
         {
-          int inverted = 0;
-          if (str_ends_with(attribute, ".not"))
-            {
-              attribute[name_len - 4] = '\0';
-              inverted = 1;
-            }
-
-          element_sanitizer_add_regex(element_sanitizer, attribute, (const char *)value, inverted);
+          struct AttributeRule *rule = list->items[j];
+          res[j] = (const char *)rule->value;
+          inverted[j] = rule->kind == RULE_NOT_MATCH;
         }
 
-      xmlFree(value);
-      free(attribute);
+      element_sanitizer_set_checker(element_sanitizer, attributes->items[i],
+                                    checker_pool_get(mode->checkers, res, inverted, list->size));
+      free(res);
+      free(inverted);
     }
+
+  array_free(attributes);
+  dict_free(checks);
+  return element_sanitizer;
+}
+
+/* a count, 0 (no limit) when it is not one */
+static unsigned long parse_limit(const xmlChar *value)
+{
+  char *end;
+  unsigned long limit;
+
+  if (!value || !isdigit(*value))
+    return 0;
+  limit = strtoul((const char *)value, &end, 10);
+  return *end ? 0 : limit;
 }
 
 static struct sanitize_mode *mode_deserialize(xmlDocPtr doc)
@@ -117,10 +330,11 @@ static struct sanitize_mode *mode_deserialize(xmlDocPtr doc)
   mode = mode_new();
 
   for (attr = root_element->properties; attr; attr = attr->next)
-    if (!xmlStrcmp(attr->name, BAD_CAST("allow_comments")) ||
-        !xmlStrcmp(attr->name, BAD_CAST("allow-comments")))
-      {
-        xmlChar* value = xmlNodeListGetString(doc, attr->children, 1);
+    {
+      xmlChar* value = xmlNodeListGetString(doc, attr->children, 1);
+
+      if (!xmlStrcmp(attr->name, BAD_CAST("allow_comments")) ||
+          !xmlStrcmp(attr->name, BAD_CAST("allow-comments")))
         mode->allow_comments =
           !xmlStrcasecmp(value, BAD_CAST("1"))    ||
           !xmlStrcasecmp(value, BAD_CAST("yes"))  ||
@@ -128,8 +342,18 @@ static struct sanitize_mode *mode_deserialize(xmlDocPtr doc)
           !xmlStrcasecmp(value, BAD_CAST("true")) ||
           !xmlStrcasecmp(value, BAD_CAST("t"))    ||
           !xmlStrcasecmp(value, BAD_CAST("on"));
-        xmlFree(value);
-      }
+      else if (!xmlStrcmp(attr->name, BAD_CAST("max-input")))
+        mode->limits.max_input = parse_limit(value);
+      else if (!xmlStrcmp(attr->name, BAD_CAST("max-depth")))
+        mode->limits.max_depth = parse_limit(value);
+      else if (!xmlStrcmp(attr->name, BAD_CAST("max-nodes")))
+        mode->limits.max_nodes = parse_limit(value);
+      else if (!xmlStrcmp(attr->name, BAD_CAST("max-attributes")))
+        mode->limits.max_attributes = parse_limit(value);
+      else if (!xmlStrcmp(attr->name, BAD_CAST("on-limit")))
+        mode->limits.escape = !xmlStrcasecmp(value, BAD_CAST("escape"));
+      xmlFree(value);
+    }
 
   for (node = root_element->children; node; node = node->next)
     {
@@ -138,14 +362,28 @@ static struct sanitize_mode *mode_deserialize(xmlDocPtr doc)
 
       if (!xmlStrcmp(node->name, BAD_CAST("elements")))
         {
+          Array *common_rules = array_new((free_function_t)free_attribute_rule);
+          mode_parse_attributes(common_rules, node);
+
           for (child = node->children; child; child = child->next)
             if (child->type == XML_ELEMENT_NODE)
               {
-                ElementSanitizer *element_sanitizer = element_sanitizer_new();
-                mode_load_attributes(element_sanitizer, node);  /* common attributes */
-                mode_load_attributes(element_sanitizer, child);
+                Array *rules = array_new((free_function_t)free_attribute_rule);
+                ElementSanitizer *element_sanitizer;
+
+                mode_parse_attributes(rules, child);
+                element_sanitizer = mode_build_element_sanitizer(mode, common_rules, rules);
+                array_free(rules);
+                if (!element_sanitizer)
+                  {
+                    array_free(common_rules);
+                    mode_free(mode);
+                    return NULL;
+                  }
                 dict_replace(mode->elements, (const char *)child->name, element_sanitizer);
               }
+
+          array_free(common_rules);
         }
       else if (!xmlStrcmp(node->name, BAD_CAST("rename")))
         {
@@ -165,6 +403,8 @@ static struct sanitize_mode *mode_deserialize(xmlDocPtr doc)
         }
     }
 
+  mode_compile(mode);
+
   return mode;
 }
 
@@ -188,3 +428,217 @@ struct sanitize_mode *mode_memory(const char *data)
   return mode;
 }
 
+
+/* compiled modes */
+
+#define IMAGE_MAGIC "SANMODE"
+#define IMAGE_VERSION (3)           /* bumped whenever a record or a hash function changes */
+#define IMAGE_BYTE_ORDER (0x01020304u)
+
+struct NamedImage
+{
+  image_offset name;
+  image_offset target;          /* element sanitizer, rename target or nothing */
+};
+
+struct ModeImage
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t size;
+  uint32_t allow_comments;
+  uint32_t limit_escape;
+  uint64_t max_input;
+  uint64_t max_depth;
+  uint64_t max_nodes;
+  uint64_t max_attributes;
+  image_offset tags;
+  uint32_t element_count;
+  image_offset elements;
+  uint32_t delete_count;
+  image_offset deletes;
+  uint32_t rename_count;
+  image_offset renames;
+};
+
+static image_offset save_names(ImageWriter *w, Dict *dict, enum tag_action_kind kind, uint32_t *count)
+{
+  Array *names = dict_keys(dict);
+  image_offset offset;
+  size_t i;
+
+  offset = image_reserve(w, names->size * sizeof(struct NamedImage));
+  for (i = 0; i < names->size; ++i)
+    {
+      image_offset name = image_write_string(w, names->items[i]);
+      image_offset target = 0;
+      struct NamedImage *named;
+
+      if (kind == TAG_ALLOW)
+        target = element_sanitizer_save(dict_get(dict, names->items[i]), w);
+      else if (kind == TAG_RENAME)
+        target = image_write_string(w, dict_get(dict, names->items[i]));
+
+      named = (struct NamedImage *)image_record(w, offset) + i;
+      named->name = name;
+      named->target = target;
+    }
+
+  *count = names->size;
+  array_free(names);
+  return offset;
+}
+
+int mode_save_compiled(struct sanitize_mode *mode, const char *filename)
+{
+  ImageWriter w;
+  struct ModeImage *header;
+  image_offset tags, elements, deletes, renames;
+  uint32_t element_count, delete_count, rename_count;
+  char *temporary;
+  int fd, result = -1;
+
+  if (!mode->tags)
+    mode_compile(mode);
+
+  image_writer_init(&w);
+  image_reserve(&w, sizeof(struct ModeImage));
+  elements = save_names(&w, mode->elements, TAG_ALLOW, &element_count);
+  deletes = save_names(&w, mode->delete_elements, TAG_DELETE, &delete_count);
+  renames = save_names(&w, mode->rename_elements, TAG_RENAME, &rename_count);
+  tags = tag_table_save(mode->tags, &w);
+
+  header = image_record(&w, 0);
+  memcpy(header->magic, IMAGE_MAGIC, sizeof(header->magic));
+  header->version = IMAGE_VERSION;
+  header->byte_order = IMAGE_BYTE_ORDER;
+  header->size = w.data.length;
+  header->allow_comments = mode->allow_comments;
+  header->limit_escape = mode->limits.escape;
+  header->max_input = mode->limits.max_input;
+  header->max_depth = mode->limits.max_depth;
+  header->max_nodes = mode->limits.max_nodes;
+  header->max_attributes = mode->limits.max_attributes;
+  header->tags = tags;
+  header->element_count = element_count;
+  header->elements = elements;
+  header->delete_count = delete_count;
+  header->deletes = deletes;
+  header->rename_count = rename_count;
+  header->renames = renames;
+
+  /* written aside and renamed over the target, so that no process maps a partial image */
+  temporary = malloc(strlen(filename) + 8);
+  sprintf(temporary, "%s.XXXXXX", filename);
+  fd = mkstemp(temporary);
+  if (fd >= 0)
+    {
+      size_t written = 0;
+
+      while (written < w.data.length)
+        {
+          ssize_t n = write(fd, w.data.data + written, w.data.length - written);
+          if (n <= 0)
+            break;
+          written += n;
+        }
+      if (written == w.data.length && !fchmod(fd, 0644) && !close(fd))
+        {
+          fd = -1;
+          if (!rename(temporary, filename))
+            result = 0;
+        }
+      if (fd >= 0)
+        close(fd);
+      if (result)
+        unlink(temporary);
+    }
+
+  free(temporary);
+  image_writer_destroy(&w);
+  return result;
+}
+
+static int load_names(struct sanitize_mode *mode, ImageReader *r, Dict *dict, enum tag_action_kind kind,
+                      image_offset offset, uint32_t count)
+{
+  const struct NamedImage *named = image_at(r, offset, sizeof(struct NamedImage), count);
+  size_t i;
+
+  if (!named)
+    return 0;
+  for (i = 0; i < count; ++i)
+    {
+      const char *name = image_string(r, named[i].name);
+      void *value = (void *)Q_WHITESPACE;
+
+      if (!name)
+        return 0;
+      if (kind == TAG_ALLOW)
+        value = element_sanitizer_load(mode->arena, mode->checkers, r, named[i].target);
+      else if (kind == TAG_RENAME)
+        value = image_string(r, named[i].target) ? (void *)quark(image_string(r, named[i].target)) : NULL;
+      if (!value)
+        return 0;
+      dict_replace(dict, name, value);
+    }
+  return 1;
+}
+
+struct sanitize_mode *mode_load_compiled(const char *filename)
+{
+  struct sanitize_mode *mode;
+  const struct ModeImage *header;
+  ImageReader r;
+  struct stat st;
+  void *image;
+  int fd, ok;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct ModeImage) || st.st_size > UINT32_MAX)
+    {
+      close(fd);
+      return NULL;
+    }
+  image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED)
+    return NULL;
+
+  header = image;
+  if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) || header->version != IMAGE_VERSION ||
+      header->byte_order != IMAGE_BYTE_ORDER || header->size != (size_t)st.st_size)
+    {
+      munmap(image, st.st_size);
+      return NULL;
+    }
+
+  mode = mode_new();
+  mode->image = image;
+  mode->image_size = st.st_size;
+  mode->allow_comments = header->allow_comments != 0;
+  mode->limits.escape = header->limit_escape != 0;
+  mode->limits.max_input = header->max_input;
+  mode->limits.max_depth = header->max_depth;
+  mode->limits.max_nodes = header->max_nodes;
+  mode->limits.max_attributes = header->max_attributes;
+
+  image_reader_init(&r, image, st.st_size);
+  ok = load_names(mode, &r, mode->elements, TAG_ALLOW, header->elements, header->element_count) &&
+    load_names(mode, &r, mode->delete_elements, TAG_DELETE, header->deletes, header->delete_count) &&
+    load_names(mode, &r, mode->rename_elements, TAG_RENAME, header->renames, header->rename_count) &&
+    (mode->tags = tag_table_load(mode->arena, mode->checkers, &r, header->tags));
+  image_reader_destroy(&r);
+
+  if (!ok)
+    {
+      mode_free(mode);
+      return NULL;
+    }
+
+  mode_intern_names(mode);
+  return mode;
+}
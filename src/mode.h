@@ -1,31 +1,97 @@
 #ifndef SANITIZE_MODE_H_INCLUDED
 #define SANITIZE_MODE_H_INCLUDED
 
+#include <libxml/xmlstring.h>
+#include <libxml/dict.h>
+#include "arena.h"
 #include "array.h"
 #include "dict.h"
 #include "element_sanitizer.h"
 #include "value_checker.h"
 #include "quarks.h"
+#include "tag_table.h"
+#include "stats.h"
+#include "trace.h"
+#include "budget.h"
 
 /* quarks */
 extern const char *Q_WHITESPACE;
 
 void mode_init_quarks(void);
 
+/* library */
+
+/*
+ * One-time global setup: libxml2 and the quark table. mode_new() calls
+ * it; a program that uses several threads should call it once up front.
+ * sanitize_cleanup() releases everything again once no mode is left.
+ */
+void sanitize_init(void);
+void sanitize_cleanup(void);
+
 /* mode */
 
+/*
+ * Everything a mode holds, the struct included, comes from its arena:
+ * mode_free() releases it in one go.
+ */
 struct sanitize_mode
 {
+  Arena *arena;
   int allow_comments;
   Dict *elements;               /* tag name --> element sanitizer */
   Dict *delete_elements;        /* set */
   Dict *rename_elements;
+  TagTable *tags;               /* compiled from the three dicts above */
+  xmlDictPtr names;             /* tag and attribute names; parent of every parser's dictionary */
+  CheckerPool *checkers;        /* value checkers shared by the element sanitizers */
+  const void *image;            /* mapped by mode_load_compiled(); tables point into it */
+  size_t image_size;
+  long refs;                    /* references through a mode handle */
+  Stats *stats;                 /* what the calls on the mode did */
+  Tracer tracer;                /* phase timings of each call */
+  struct sanitize_limits limits;
 };
 
 struct sanitize_mode *mode_new(void);
 struct sanitize_mode *mode_load(const char *filename);
 struct sanitize_mode *mode_memory(const char *data);
+void mode_compile(struct sanitize_mode *mode);
 void mode_free(struct sanitize_mode *mode);
+/* bytes held by the mode's arena */
+size_t mode_memory_usage(const struct sanitize_mode *mode);
+
+/* counters of all calls on the mode so far; always zero when built with SANITIZE_NO_STATS */
+void mode_stats_snapshot(const struct sanitize_mode *mode, struct sanitize_stats *stats);
+/* how often the action for a tag (allow, delete or rename) was taken */
+unsigned long long mode_stats_tag(const struct sanitize_mode *mode, const char *name);
+
+/*
+ * Hands the phase timings and sizes of every later call on the mode to
+ * trace; NULL turns tracing off. Set it before the mode is shared
+ * between threads: trace may then be called from any of them.
+ */
+void mode_set_trace(struct sanitize_mode *mode, sanitize_trace_function trace, void *context);
+
+/*
+ * Limits also come from the mode's root element: max-input, max-depth,
+ * max-nodes, max-attributes and on-limit="escape". Set them before the
+ * mode is shared between threads.
+ */
+void mode_set_limits(struct sanitize_mode *mode, const struct sanitize_limits *limits);
+void mode_get_limits(const struct sanitize_mode *mode, struct sanitize_limits *limits);
+
+/*
+ * Compiled modes: a binary image of the tag table, the attribute tables
+ * and the matcher automata, written by the mode-compile tool. Loading
+ * maps the file read-only and builds a few small tables around it: no
+ * XML is parsed and no automaton rebuilt, and every process that loads
+ * the same file shares its pages. Only patterns left to regcomp() are
+ * compiled again. An image is only read by the library version that
+ * wrote it; mode_load_compiled() returns NULL for any other file.
+ */
+int mode_save_compiled(struct sanitize_mode *mode, const char *filename);
+struct sanitize_mode *mode_load_compiled(const char *filename);
 
 #endif
 
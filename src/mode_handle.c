@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "mode_handle.h"
+
+/*
+ * Readers announce themselves in one of two counters, chosen by the
+ * parity of the epoch, for the few instructions between reading the
+ * current mode and taking a reference to it. A writer swaps the mode in,
+ * moves the epoch on, and waits for the counter of the previous epoch to
+ * drain: after that no reader can still take a reference to the old mode
+ * except through one it already holds. New readers count in the other
+ * counter meanwhile, so the wait is short however busy the handle is.
+ */
+
+struct sanitize_mode_handle
+{
+  struct sanitize_mode *current;  /* holds one reference of its own */
+  unsigned long epoch;
+  long readers[2];
+  pthread_mutex_t replace_lock;
+};
+
+struct sanitize_mode_handle *mode_handle_new(struct sanitize_mode *mode)
+{
+  struct sanitize_mode_handle *handle = malloc(sizeof(struct sanitize_mode_handle));
+
+  mode->refs = 1;
+  handle->current = mode;
+  handle->epoch = 0;
+  handle->readers[0] = handle->readers[1] = 0;
+  pthread_mutex_init(&handle->replace_lock, NULL);
+  return handle;
+}
+
+struct sanitize_mode *mode_handle_acquire(struct sanitize_mode_handle *handle)
+{
+  struct sanitize_mode *mode;
+  unsigned long epoch;
+  long *readers;
+
+  /* counted under the epoch that is still current once counted */
+  for (;;)
+    {
+      epoch = __atomic_load_n(&handle->epoch, __ATOMIC_SEQ_CST);
+      readers = &handle->readers[epoch & 1];
+      __atomic_add_fetch(readers, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&handle->epoch, __ATOMIC_SEQ_CST) == epoch)
+        break;
+      __atomic_sub_fetch(readers, 1, __ATOMIC_SEQ_CST);
+    }
+
+  mode = __atomic_load_n(&handle->current, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&mode->refs, 1, __ATOMIC_SEQ_CST);
+  __atomic_sub_fetch(readers, 1, __ATOMIC_SEQ_CST);
+  return mode;
+}
+
+void mode_handle_release(struct sanitize_mode *mode)
+{
+  if (mode && !__atomic_sub_fetch(&mode->refs, 1, __ATOMIC_ACQ_REL))
+    mode_free(mode);
+}
+
+void mode_handle_replace(struct sanitize_mode_handle *handle, struct sanitize_mode *mode)
+{
+  struct sanitize_mode *old;
+  unsigned long epoch;
+
+  mode->refs = 1;
+
+  pthread_mutex_lock(&handle->replace_lock);
+  old = __atomic_exchange_n(&handle->current, mode, __ATOMIC_SEQ_CST);
+  epoch = __atomic_add_fetch(&handle->epoch, 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&handle->readers[(epoch - 1) & 1], __ATOMIC_SEQ_CST))
+    sched_yield();
+  pthread_mutex_unlock(&handle->replace_lock);
+
+  mode_handle_release(old);
+}
+
+void mode_handle_free(struct sanitize_mode_handle *handle)
+{
+  if (!handle)
+    return;
+  mode_handle_release(handle->current);
+  pthread_mutex_destroy(&handle->replace_lock);
+  free(handle);
+}
@@ -0,0 +1,27 @@
+#ifndef SANITIZE_MODE_HANDLE_H_INCLUDED
+#define SANITIZE_MODE_HANDLE_H_INCLUDED
+
+#include "mode.h"
+
+/*
+ * A mode that can be replaced while other threads use it. A reader takes
+ * the current version with mode_handle_acquire() and gives it back with
+ * mode_handle_release(); neither call locks or waits. mode_handle_replace()
+ * publishes a new version at once: calls already running finish on the
+ * old one, which is freed by whoever releases it last.
+ *
+ * The handle owns the modes given to it. Replacing is serialized; the
+ * replacing thread waits only for readers caught halfway through an
+ * acquire, never for a sanitize() call.
+ */
+
+struct sanitize_mode_handle;
+
+struct sanitize_mode_handle *mode_handle_new(struct sanitize_mode *mode);
+struct sanitize_mode *mode_handle_acquire(struct sanitize_mode_handle *handle);
+void mode_handle_release(struct sanitize_mode *mode);
+void mode_handle_replace(struct sanitize_mode_handle *handle, struct sanitize_mode *mode);
+/* once no thread uses the handle any more */
+void mode_handle_free(struct sanitize_mode_handle *handle);
+
+#endif
@@ -0,0 +1,52 @@
+#include "name_index.h"
+
+#define INITIAL_SIZE (8)
+
+NameIndex *name_index_new(Arena *arena, size_t count)
+{
+  NameIndex *index = arena_alloc(arena, sizeof(struct NameIndex));
+  size_t size = INITIAL_SIZE;
+
+  while (size < 2 * count)
+    size *= 2;
+  index->arena = arena;
+  index->mask = size - 1;
+  index->count = 0;
+  index->entries = arena_calloc(arena, size, sizeof(struct NameEntry));
+  return index;
+}
+
+static void insert(NameIndex *index, const void *name, void *value)
+{
+  size_t i;
+
+  for (i = name_index_slot(index, name); index->entries[i].name; i = (i + 1) & index->mask)
+    if (index->entries[i].name == name)
+      {
+        index->entries[i].value = value;
+        return;
+      }
+
+  index->entries[i].name = name;
+  index->entries[i].value = value;
+  ++index->count;
+}
+
+void name_index_set(NameIndex *index, const void *name, void *value)
+{
+  /* at most half full, so that probes stay short and misses terminate */
+  if (2 * (index->count + 1) > index->mask + 1)
+    {
+      struct NameEntry *old = index->entries;
+      size_t i, size = index->mask + 1;
+
+      index->mask = 2 * size - 1;
+      index->count = 0;
+      index->entries = arena_calloc(index->arena, 2 * size, sizeof(struct NameEntry));
+      for (i = 0; i < size; ++i)
+        if (old[i].name)
+          insert(index, old[i].name, old[i].value);
+    }
+
+  insert(index, name, value);
+}
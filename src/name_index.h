@@ -0,0 +1,48 @@
+#ifndef SANITIZE_NAME_INDEX_H_INCLUDED
+#define SANITIZE_NAME_INDEX_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+/*
+ * Interned name --> value, compared by address only. A name that was
+ * interned elsewhere, or not at all, simply misses. Lives in an arena.
+ */
+
+typedef struct NameIndex NameIndex;
+
+struct NameEntry
+{
+  const void *name;
+  void *value;
+};
+
+struct NameIndex
+{
+  Arena *arena;
+  size_t mask;
+  size_t count;
+  struct NameEntry *entries;
+};
+
+/* room for count names without growing */
+NameIndex *name_index_new(Arena *arena, size_t count);
+void name_index_set(NameIndex *index, const void *name, void *value);
+
+static inline size_t name_index_slot(const NameIndex *index, const void *name)
+{
+  return (size_t)(((uint64_t)(uintptr_t)name * 0x9e3779b97f4a7c15ull) >> 32) & index->mask;
+}
+
+static inline void *name_index_get(const NameIndex *index, const void *name)
+{
+  size_t i;
+
+  for (i = name_index_slot(index, name); index->entries[i].name; i = (i + 1) & index->mask)
+    if (index->entries[i].name == name)
+      return index->entries[i].value;
+  return NULL;
+}
+
+#endif
@@ -0,0 +1,149 @@
+#include <string.h>
+#include <libxml/parserInternals.h>
+
+#include "prescan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PRESCAN_X86
+#endif
+
+/*
+ * The scanners return the offset of the first byte that is not plain
+ * ASCII text: '<', '&', a control character other than tab and newline,
+ * or a byte of a multibyte sequence. Those are looked at one by one.
+ */
+
+static int is_special(unsigned char c)
+{
+  return c == '<' || c == '&' || (c < 0x20 && c != '\t' && c != '\n') || c >= 0x80;
+}
+
+static size_t find_special_scalar(const unsigned char *p, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; ++i)
+    if (is_special(p[i]))
+      break;
+  return i;
+}
+
+#ifdef PRESCAN_X86
+
+static size_t find_special_sse2(const unsigned char *p, size_t len)
+{
+  const __m128i lt = _mm_set1_epi8('<'), amp = _mm_set1_epi8('&');
+  const __m128i tab = _mm_set1_epi8('\t'), nl = _mm_set1_epi8('\n');
+  const __m128i space = _mm_set1_epi8(0x20);
+  size_t i = 0;
+
+  for (; i + 16 <= len; i += 16)
+    {
+      const __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+      /* signed compare: bytes >= 0x80 count as below 0x20 */
+      const __m128i control = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, nl)),
+                                               _mm_cmplt_epi8(v, space));
+      const __m128i special = _mm_or_si128(control, _mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, amp)));
+      const unsigned mask = _mm_movemask_epi8(special);
+
+      if (mask)
+        return i + __builtin_ctz(mask);
+    }
+  return i + find_special_scalar(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_special_avx2(const unsigned char *p, size_t len)
+{
+  const __m256i lt = _mm256_set1_epi8('<'), amp = _mm256_set1_epi8('&');
+  const __m256i tab = _mm256_set1_epi8('\t'), nl = _mm256_set1_epi8('\n');
+  const __m256i space = _mm256_set1_epi8(0x20);
+  size_t i = 0;
+
+  for (; i + 32 <= len; i += 32)
+    {
+      const __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+      const __m256i control = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(v, nl)),
+                                                  _mm256_cmpgt_epi8(space, v));
+      const __m256i special = _mm256_or_si256(control, _mm256_or_si256(_mm256_cmpeq_epi8(v, lt), _mm256_cmpeq_epi8(v, amp)));
+      const unsigned mask = _mm256_movemask_epi8(special);
+
+      if (mask)
+        return i + __builtin_ctz(mask);
+    }
+  return i + find_special_sse2(p + i, len - i);
+}
+
+static size_t find_special(const unsigned char *p, size_t len)
+{
+  if (__builtin_cpu_supports("avx2"))
+    return find_special_avx2(p, len);
+  return find_special_sse2(p, len);
+}
+
+#else
+
+static size_t find_special(const unsigned char *p, size_t len)
+{
+  return find_special_scalar(p, len);
+}
+
+#endif
+
+/* length of the well-formed UTF-8 sequence of an XML character at p, 0 if there is none */
+static size_t utf8_sequence(const unsigned char *p, size_t len)
+{
+  unsigned c;
+  size_t n, i;
+
+  if (p[0] >= 0xc2 && p[0] <= 0xdf)
+    n = 2, c = p[0] & 0x1f;
+  else if (p[0] >= 0xe0 && p[0] <= 0xef)
+    n = 3, c = p[0] & 0x0f;
+  else if (p[0] >= 0xf0 && p[0] <= 0xf4)
+    n = 4, c = p[0] & 0x07;
+  else
+    return 0;
+
+  if (len < n)
+    return 0;
+  for (i = 1; i < n; ++i)
+    {
+      if ((p[i] & 0xc0) != 0x80)
+        return 0;
+      c = c << 6 | (p[i] & 0x3f);
+    }
+
+  if ((n == 3 && c < 0x800) || (n == 4 && (c < 0x10000 || c > 0x10ffff)))
+    return 0;                   /* overlong or out of range */
+  if ((c >= 0xd800 && c <= 0xdfff) || c == 0xfffe || c == 0xffff)
+    return 0;                   /* not a character XML allows */
+  return n;
+}
+
+int prescan_is_plain_text(const char *html, size_t len)
+{
+  const unsigned char *p = (const unsigned char *)html;
+  size_t i = 0;
+
+  if (!len)
+    return 0;                   /* an empty fragment has no text node */
+  if (len > XML_MAX_TEXT_LENGTH)
+    return 0;                   /* the parser truncates longer text nodes */
+
+  for (;;)
+    {
+      size_t n;
+
+      i += find_special(p + i, len - i);
+      if (i == len)
+        return 1;
+      if (p[i] < 0x80)
+        return 0;
+      n = utf8_sequence(p + i, len - i);
+      if (!n)
+        return 0;
+      i += n;
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef SANITIZE_PRESCAN_H_INCLUDED
+#define SANITIZE_PRESCAN_H_INCLUDED
+
+#include <stddef.h>
+
+/*
+ * Plain text is input that libxml2 turns into a single text node, kept
+ * verbatim: no '<', no '&', no control character other than tab and
+ * newline, only well-formed UTF-8 for characters XML allows, and not
+ * more than the parser keeps in one text node. The sanitized form of
+ * plain text is the text itself, escaped.
+ */
+
+int prescan_is_plain_text(const char *html, size_t len);
+
+#endif
@@ -1,69 +1,129 @@
 #include <stdlib.h>
 #include <string.h>
-
-#include <stdio.h>
-
+#include <pthread.h>
 
 #include "common.h"
-#include "array.h"
-
-#define HASH_SIZE (97)
+#include "arena.h"
+
+#define INITIAL_SIZE (64)
+
+/*
+ * Interned strings: an open-addressing hash set of pointers into an
+ * arena. A string is copied once, when it is first seen, and lives until
+ * free_quarks(); is_quark() only asks the arena whether it owns the
+ * address.
+ *
+ * Read-mostly: lookups of existing quarks and is_quark() share the lock,
+ * only adding a new quark takes it exclusively.
+ */
+static pthread_rwlock_t quarks_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+struct QuarkEntry
+{
+  const char *str;              /* NULL: empty slot */
+  unsigned hash;
+};
 
-static Array *quarks = NULL;
-static Array *quarks_index = NULL;
+static Arena *strings = NULL;
+static struct QuarkEntry *entries = NULL;
+static size_t mask = 0;
+static size_t count = 0;
 
-void init_quarks(void)
+/* with the write lock held */
+static void create_quarks(void)
 {
-  size_t index;
-  
-  if (quarks)
+  if (strings)
     return;
 
-  quarks = array_new((free_function_t)array_free);
-  array_reserve(quarks, HASH_SIZE);
-  for (index = 0; index < HASH_SIZE; ++index)
-    array_append(quarks, array_new((free_function_t)free));
+  strings = arena_new();
+  entries = calloc(INITIAL_SIZE, sizeof(struct QuarkEntry));
+  mask = INITIAL_SIZE - 1;
+  count = 0;
+}
 
-  quarks_index = array_new(NULL);
+void init_quarks(void)
+{
+  pthread_rwlock_wrlock(&quarks_lock);
+  create_quarks();
+  pthread_rwlock_unlock(&quarks_lock);
 }
 
 void free_quarks(void)
 {
-  array_free(quarks);
-  array_free(quarks_index);
-  quarks = quarks_index = NULL;
+  pthread_rwlock_wrlock(&quarks_lock);
+  arena_free(strings);
+  free(entries);
+  strings = NULL;
+  entries = NULL;
+  mask = count = 0;
+  pthread_rwlock_unlock(&quarks_lock);
 }
 
-const char *quark(const char *str)
+/* the entry holding str, or the empty slot where it belongs */
+static struct QuarkEntry *find_quark(const char *str, unsigned hash)
 {
-  Array *bucket;
-  char *value;
-  size_t index;
+  size_t i;
 
-  init_quarks();
+  for (i = hash & mask; ; i = (i + 1) & mask)
+    if (!entries[i].str || (entries[i].hash == hash && !strcmp(entries[i].str, str)))
+      return &entries[i];
+}
 
-  bucket = quarks->items[hash_function(str, 0) % HASH_SIZE];
-  value = array_find_not(bucket, (array_item_predicate_t)strcmp, str);
+/* with the write lock held */
+static void grow_quarks(void)
+{
+  struct QuarkEntry *old = entries;
+  size_t i, size = mask + 1;
+
+  entries = calloc(2 * size, sizeof(struct QuarkEntry));
+  mask = 2 * size - 1;
+  for (i = 0; i < size; ++i)
+    if (old[i].str)
+      *find_quark(old[i].str, old[i].hash) = old[i];
+  free(old);
+}
 
-  if (!value)
+const char *quark(const char *str)
+{
+  const unsigned hash = hash_function(str, strlen(str));
+  struct QuarkEntry *entry;
+  const char *value = NULL;
+
+  pthread_rwlock_rdlock(&quarks_lock);
+  if (entries)
+    value = find_quark(str, hash)->str;
+  pthread_rwlock_unlock(&quarks_lock);
+  if (value)
+    return value;
+
+  pthread_rwlock_wrlock(&quarks_lock);
+  create_quarks();
+  entry = find_quark(str, hash);  /* another thread may have added it meanwhile */
+  if (!entry->str)
     {
-      value = strdup(str);
-      array_append(bucket, value);
-
-      index = array_lower_bound(quarks_index, value, ptr_less);
-      array_insert(quarks_index, index, value);
+      if (4 * (count + 1) > 3 * (mask + 1))
+        {
+          grow_quarks();
+          entry = find_quark(str, hash);
+        }
+      entry->str = arena_strdup(strings, str);
+      entry->hash = hash;
+      ++count;
     }
+  value = entry->str;
+  pthread_rwlock_unlock(&quarks_lock);
 
   return value;
 }
 
 int is_quark(char *value)
 {
-  if (!quarks)
-    return 0;
+  int result;
 
-  size_t lb = array_lower_bound(quarks_index, value, ptr_less);
-  return lb < quarks_index->size && value == quarks_index->items[lb];
+  pthread_rwlock_rdlock(&quarks_lock);
+  result = arena_owns(strings, value);
+  pthread_rwlock_unlock(&quarks_lock);
+  return result;
 }
 
 void qfree(void *mem)
@@ -71,4 +131,3 @@ void qfree(void *mem)
   if (mem && !is_quark(mem))
     free(mem);
 }
-
@@ -2,7 +2,11 @@
 #include <string.h>
 #include <libxml/HTMLtree.h>
 #include <libxml/HTMLparser.h>
+#include <libxml/SAX2.h>
 #include "sanitize.h"
+#include "source.h"
+#include "prescan.h"
+#include "html_writer.h"
 
 static unsigned move_children_before(xmlNodePtr element, xmlNodePtr before)
 {
@@ -21,65 +25,119 @@ static unsigned move_children_before(xmlNodePtr element, xmlNodePtr before)
   return count;
 }
 
-static void clean_element(xmlNodePtr element, struct sanitize_mode *mode)
+static void set_attribute_value(xmlAttrPtr attr, const char *value)
 {
-  ElementSanitizer *element_sanitizer;
+  xmlNodePtr text;
 
-  element_sanitizer = dict_get(mode->elements, (const char *)element->name);
+  xmlFreeNodeList(attr->children);
+  text = xmlNewDocText(attr->doc, BAD_CAST(value));
+  text->parent = (xmlNodePtr)attr;
+  attr->children = attr->last = text;
+}
+
+/* the value without a copy when it is a single text node; otherwise *copy holds it */
+static const char *attribute_value(xmlAttrPtr attr, xmlChar **copy)
+{
+  xmlNodePtr child = attr->children;
+
+  if (!child)
+    return NULL;
+  if (!child->next && child->type == XML_TEXT_NODE)
+    return child->content ? (const char *)child->content : "";
+  *copy = xmlNodeListGetString(attr->doc, child, 1);
+  return (const char *)*copy;
+}
 
-  if (element_sanitizer)
+static void remove_attribute(xmlAttrPtr attr)
+{
+  xmlUnlinkNode((xmlNodePtr)attr);
+  xmlFreeProp(attr);
+}
+
+static void clean_element(xmlNodePtr element, struct sanitize_mode *mode, struct StatsTally *tally)
+{
+  const struct TagAction *action;
+  int renames = 0;
+
+ again:
+  action = tag_table_lookup_interned(mode->tags, (const char *)element->name);
+  if (action)
+    tag_table_count(mode->tags, action, tally);
+  if (action && action->kind == TAG_RENAME && action->rename_to != Q_WHITESPACE && ++renames > TAG_MAX_RENAMES)
+    action = NULL;
+
+  if (action && action->kind == TAG_ALLOW)
     {
       /* element is allowed */
 
+      ElementSanitizer *element_sanitizer = action->sanitizer;
+      const struct MandatoryAttribute *mandatory;
+      size_t mandatory_count, i;
+      unsigned long long present = 0;  /* mandatory attributes already on the element */
       xmlAttrPtr attr, next;
-      xmlChar *value;
+
+      STATS_COUNT(tally, SANITIZE_ELEMENTS_KEPT);
+      mandatory_count = element_sanitizer_get_mandatory_attributes(element_sanitizer, &mandatory);
+
       for (attr = element->properties; attr; attr = next)
         {
-          next = attr->next;
-	  value = xmlNodeListGetString(element->doc, attr->children, 1);
+          ValueChecker *checker;
+          xmlChar *copy = NULL;
 
-	  if (!element_sanitizer_is_valid(element_sanitizer, (const char *)attr->name,(const char *)value))
-	    {
-	      xmlUnsetProp(element, attr->name);
-	    }
+          next = attr->next;
 
-	  xmlFree(value);
+          /* the name alone decides for most attributes */
+          checker = element_sanitizer_get_checker_interned(element_sanitizer, (const char *)attr->name);
+          if (!checker)
+            {
+              STATS_COUNT(tally, SANITIZE_ATTRIBUTES_DROPPED_BY_NAME);
+              remove_attribute(attr);
+            }
+          else if (!value_checker_check(checker, attribute_value(attr, &copy), tally))
+            {
+              STATS_COUNT(tally, SANITIZE_ATTRIBUTES_DROPPED_BY_VALUE);
+              remove_attribute(attr);
+            }
+          else
+            {
+              for (i = 0; i < mandatory_count; ++i)
+                if (!strcmp(mandatory[i].name, (const char *)attr->name))
+                  {
+                    STATS_COUNT(tally, SANITIZE_ATTRIBUTES_SET);
+                    set_attribute_value(attr, mandatory[i].value);
+                    present |= 1ULL << i;
+                    break;
+                  }
+            }
+
+          xmlFree(copy);
         }
 
-      /* mandatory attributes */
-      {
-        Dict *mandatory_attributes = element_sanitizer_get_mandatory_attributes(element_sanitizer);
-        Array *mandatory_attributes_names = dict_keys(mandatory_attributes);
-        size_t i;
-
-        for (i = 0; i < mandatory_attributes_names->size; ++i)
+      /* mandatory attributes which were missing or invalid */
+      for (i = 0; i < mandatory_count; ++i)
+        if (!(present & (1ULL << i)))
           {
-            const char *attribute = mandatory_attributes_names->items[i];
-            const char *value = dict_get(mandatory_attributes, attribute);
-
-            xmlSetProp(element, BAD_CAST(attribute), BAD_CAST(value));
+            STATS_COUNT(tally, SANITIZE_ATTRIBUTES_SET);
+            xmlNewProp(element, BAD_CAST(mandatory[i].name), BAD_CAST(mandatory[i].value));
           }
 
-        array_free(mandatory_attributes_names);
-      }
-
       return;
     }
 
-  if (dict_get(mode->delete_elements, (const char *)element->name))
+  if (action && action->kind == TAG_DELETE)
     {
       /* delete with children */
+      STATS_COUNT(tally, SANITIZE_ELEMENTS_DELETED);
       xmlUnlinkNode(element);
       xmlFreeNode(element);
 
       return;
     }
 
-  const char *rename_to = dict_get(mode->rename_elements, (const char *)element->name);
-
-  if (!rename_to)
+  if (!action)
     {
       /* remove */
+      STATS_COUNT(tally, SANITIZE_ELEMENTS_STRIPPED);
       move_children_before(element, element);
       xmlUnlinkNode(element);
       xmlFreeNode(element);
@@ -87,8 +145,9 @@ static void clean_element(xmlNodePtr element, struct sanitize_mode *mode)
       return;
     }
 
-  if (rename_to == Q_WHITESPACE)
+  if (action->rename_to == Q_WHITESPACE)
     {
+      STATS_COUNT(tally, SANITIZE_ELEMENTS_STRIPPED);
       xmlAddPrevSibling(element, xmlNewText(BAD_CAST(" ")));
       if (move_children_before(element, element))
         xmlAddPrevSibling(element, xmlNewText(BAD_CAST(" ")));
@@ -100,25 +159,24 @@ static void clean_element(xmlNodePtr element, struct sanitize_mode *mode)
     }
 
   /* rename */
-  xmlNodeSetName(element, BAD_CAST(rename_to));
-  clean_element(element, mode); /* recursion */
+  STATS_COUNT(tally, SANITIZE_ELEMENTS_RENAMED);
+  xmlNodeSetName(element, BAD_CAST(action->rename_to));
+  goto again;
 }
 
-static xmlNodePtr clean_node(xmlNodePtr node, struct sanitize_mode *mode)
+/* a node whose children are clean already; returns its next sibling */
+static xmlNodePtr clean_node(xmlNodePtr node, struct sanitize_mode *mode, struct StatsTally *tally)
 {
-  xmlNodePtr item, next;
+  xmlNodePtr next;
 
   switch (node->type)
     {
-    case XML_DOCUMENT_FRAG_NODE:
-      for (item = node->children; item; )
-        item = clean_node(item, mode);
-      return node->next;
-      
     case XML_TEXT_NODE:
+      STATS_COUNT(tally, SANITIZE_NODES_TEXT);
       return node->next;
 
     case XML_CDATA_SECTION_NODE:
+      STATS_COUNT(tally, SANITIZE_NODES_CDATA);
       next = node->next;
       {
         xmlChar *content = xmlNodeGetContent(node);
@@ -129,6 +187,7 @@ static xmlNodePtr clean_node(xmlNodePtr node, struct sanitize_mode *mode)
       return next;
 
     case XML_COMMENT_NODE:
+      STATS_COUNT(tally, SANITIZE_NODES_COMMENT);
       next = node->next;
       if (!mode->allow_comments)
         {
@@ -138,13 +197,12 @@ static xmlNodePtr clean_node(xmlNodePtr node, struct sanitize_mode *mode)
       return next;
 
     case XML_ELEMENT_NODE:
-      for (item = node->children; item; )
-        item = clean_node(item, mode);
       next = node->next;
-      clean_element(node, mode);
+      clean_element(node, mode, tally);
       return next;
 
     default:
+      STATS_COUNT(tally, SANITIZE_NODES_OTHER);
       next = node->next;
       xmlUnlinkNode(node);
       xmlFreeNode(node);
@@ -152,84 +210,188 @@ static xmlNodePtr clean_node(xmlNodePtr node, struct sanitize_mode *mode)
     }
 }
 
-static char *wrap_div(const char *s)
+/*
+ * Children first, then their parent, found again through the parent
+ * links: no stack, however deep the fragment. What clean_element() does
+ * to an element stays among its siblings, so the parent of an element
+ * and the sibling after it are taken before it is cleaned.
+ */
+static void clean_tree(xmlNodePtr root, struct sanitize_mode *mode, struct StatsTally *tally)
 {
-  size_t l = strlen(s);
-  char *result = malloc(l + 12);
-  strcpy(result, "<div>");
-  strcpy(result+5, s);
-  strcpy(result+5+l, "</div>");
-  return result;
-}
+  xmlNodePtr node = root->children, parent, next;
 
-struct stream
-{
-  char *buffer;
-  int length;
-  int position;
-};
+  while (node)
+    {
+      if (node->type == XML_ELEMENT_NODE)
+        STATS_COUNT(tally, SANITIZE_NODES_ELEMENT);
+      if (node->type == XML_ELEMENT_NODE && node->children)
+        {
+          node = node->children;
+          continue;
+        }
 
-static int stream_write_callback(void *context, const char *buffer, int len)
-{
-  struct stream *st = context;
+      parent = node->parent;
+      next = clean_node(node, mode, tally);
 
-  if (st->length - st->position < len)
-    {
-      st->length = (st->position + len + 4095) / 4096 * 4096;
-      st->buffer = realloc(st->buffer, st->length);
+      /* the last child is clean: so is its parent's content */
+      while (!next && parent != root)
+        {
+          node = parent;
+          parent = node->parent;
+          next = clean_node(node, mode, tally);
+        }
+      node = next;
     }
-  memcpy(st->buffer + st->position, buffer, len);
-  st->position += len;
-  return len;
 }
 
-static void serialize_node(xmlNodePtr node, struct stream *stream)
+static void serialize_node(xmlNodePtr node, Buffer *out)
 {
   if (node->type == XML_DOCUMENT_FRAG_NODE)
     {
       for (node = node->children; node; node = node->next)
-        serialize_node(node, stream);
+        html_write_node(out, node);
     }
   else
+    html_write_node(out, node);
+}
+
+/*
+ * The tree builder copies every name it is given. These hooks give the
+ * document the parser's dictionary and put the parser's own interned
+ * names back in place of the copies, so that clean_element() looks tags
+ * and attributes up by address.
+ */
+
+static void on_start_document(void *ctx)
+{
+  htmlParserCtxtPtr ctxt = ctx;
+
+  xmlSAX2StartDocument(ctx);
+  if (ctxt->myDoc && !ctxt->myDoc->dict)
     {
-      xmlOutputBufferPtr buffer = xmlOutputBufferCreateIO(stream_write_callback,
-                                                          NULL,
-                                                          NULL,
-                                                          xmlFindCharEncodingHandler("utf-8"));
-      buffer->context = stream;
-      htmlNodeDumpOutput(buffer, node->doc, node, "utf-8");
-      xmlOutputBufferClose(buffer);
+      ctxt->myDoc->dict = ctxt->dict;
+      xmlDictReference(ctxt->dict);
     }
 }
 
-static char *serialize_html(xmlNodePtr node)
+static void use_interned(xmlDictPtr dict, const xmlChar **name, const xmlChar *interned)
 {
-  struct stream st;
-  st.buffer = malloc(4096);
-  st.length = 4096;
-  st.position = 0;
+  if (*name == interned || xmlDictOwns(dict, *name) || !xmlDictOwns(dict, interned) ||
+      !xmlStrEqual(*name, interned))
+    return;
+  xmlFree((xmlChar *)*name);
+  *name = interned;
+}
 
-  serialize_node(node, &st);
+/*
+ * The budget of the call, if any, hangs off the parser: what goes beyond
+ * it stops the parser. The element is pushed before startElement and
+ * popped after endElement, so nameNr counts the html, body and div
+ * elements around the fragment as well.
+ */
 
-  st.buffer[st.position] = '\0';
-  return st.buffer;
+static void charge(htmlParserCtxtPtr ctxt, int charged)
+{
+  if (!charged)
+    xmlStopParser(ctxt);
 }
 
-char *sanitize(const char *html, struct sanitize_mode *mode)
+static void on_start_element(void *ctx, const xmlChar *name, const xmlChar **atts)
+{
+  htmlParserCtxtPtr ctxt = ctx;
+  Budget *budget = ctxt->_private;
+  xmlNodePtr element;
+  xmlAttrPtr attr;
+
+  xmlSAX2StartElement(ctx, name, atts);
+  if (budget && ctxt->nameNr > 3)
+    charge(ctxt, budget_start_element(budget, atts));
+
+  element = ctxt->node;
+  if (!element || !element->doc || element->doc->dict != ctxt->dict)
+    return;
+
+  use_interned(ctxt->dict, &element->name, name);
+  for (attr = element->properties; attr && atts && atts[0]; attr = attr->next, atts += 2)
+    use_interned(ctxt->dict, &attr->name, atts[0]);
+}
+
+static void on_end_element(void *ctx, const xmlChar *name)
+{
+  htmlParserCtxtPtr ctxt = ctx;
+  Budget *budget = ctxt->_private;
+
+  if (budget && ctxt->nameNr > 3)
+    budget_end_element(budget);
+  xmlSAX2EndElement(ctx, name);
+}
+
+static void on_characters(void *ctx, const xmlChar *ch, int len)
+{
+  htmlParserCtxtPtr ctxt = ctx;
+
+  if (ctxt->_private)
+    charge(ctxt, budget_node(ctxt->_private));
+  xmlSAX2Characters(ctx, ch, len);
+}
+
+static void on_cdata_block(void *ctx, const xmlChar *value, int len)
+{
+  htmlParserCtxtPtr ctxt = ctx;
+
+  if (ctxt->_private)
+    charge(ctxt, budget_node(ctxt->_private));
+  xmlSAX2CDataBlock(ctx, value, len);
+}
+
+static void on_comment(void *ctx, const xmlChar *value)
+{
+  htmlParserCtxtPtr ctxt = ctx;
+
+  if (ctxt->_private)
+    charge(ctxt, budget_node(ctxt->_private));
+  xmlSAX2Comment(ctx, value);
+}
+
+static htmlParserCtxtPtr new_parser(struct sanitize_mode *mode)
+{
+  htmlParserCtxtPtr ctxt = source_new_parser(mode->names);
+
+  if (!ctxt)
+    return NULL;
+  if (mode->names)
+    ctxt->sax->startDocument = on_start_document;
+  ctxt->sax->startElement = on_start_element;
+  ctxt->sax->endElement = on_end_element;
+  ctxt->sax->characters = on_characters;
+  ctxt->sax->cdataBlock = on_cdata_block;
+  ctxt->sax->comment = on_comment;
+  return ctxt;
+}
+
+/* 0 on success, an empty fragment included; -1 on failure, or SANITIZE_LIMIT_EXCEEDED */
+static int sanitize_with(htmlParserCtxtPtr ctxt, const char *html, size_t len, struct sanitize_mode *mode, Buffer *out,
+                         Budget *budget, struct StatsTally *tally, Trace *trace)
 {
-  char *wrapped = NULL;
+  Source src;
   htmlDocPtr doc = NULL;
   xmlNodePtr entry = NULL;
   xmlNodePtr next = NULL;
   xmlNodePtr fragment = NULL;
-  char *result = NULL;
-
-  wrapped = wrap_div(html);
-  doc = htmlReadDoc(BAD_CAST(wrapped), NULL, "utf-8",
-		    HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING | HTML_PARSE_NONET);
-  if (!doc)
+  int result = -1;
+
+  source_init(&src, html, len);
+  ctxt->_private = budget;
+  doc = source_parse(&src, ctxt);
+  ctxt->_private = NULL;
+  trace_phase(trace, SANITIZE_PHASE_PARSE);
+  if (budget->exceeded)
+    result = SANITIZE_LIMIT_EXCEEDED;
+  if (!doc || budget->exceeded)
     goto err;
   
+  result = 0;                   /* from here on, whatever is missing is an empty fragment */
+
   entry = xmlDocGetRootElement(doc); /* html */
   if (!entry)
     goto err;
@@ -256,18 +418,172 @@ char *sanitize(const char *html, struct sanitize_mode *mode)
       xmlUnlinkNode(entry);
       xmlAddChild(fragment, entry);
     }
+  trace_phase(trace, SANITIZE_PHASE_MOVE);
 
-  clean_node(fragment, mode);
-  result = serialize_html(fragment);
+  clean_tree(fragment, mode, tally);
+  trace_phase(trace, SANITIZE_PHASE_CLEAN);
+  serialize_node(fragment, out);
+  trace_phase(trace, SANITIZE_PHASE_SERIALIZE);
+  result = 0;
 
  err:
   if (fragment)
     xmlFreeNode(fragment);
   if (doc)
     xmlFreeDoc(doc);
-  if (wrapped)
-    free(wrapped);
+  trace_phase(trace, SANITIZE_PHASE_FREE);
+
+  buffer_reserve(out, 0);
+  out->data[out->length] = '\0';
+  return result;
+}
+
+/* input without markup is a single text node: it is written without the parser */
+static int write_plain_text(const char *html, size_t len, Buffer *out)
+{
+  if (!prescan_is_plain_text(html, len))
+    return 0;
+  html_write_text(out, html, len, 0);
+  buffer_reserve(out, 0);
+  out->data[out->length] = '\0';
+  return 1;
+}
+
+static void begin_counting(struct StatsTally *tally, size_t len)
+{
+  stats_tally_init(tally);
+  STATS_COUNT(tally, SANITIZE_DOCUMENTS);
+  STATS_ADD(tally, SANITIZE_INPUT_BYTES, len);
+}
+
+/* a call beyond the mode's limits fails, or gives its input as escaped text if not too long */
+static int over_limits(struct sanitize_mode *mode, const char *html, size_t len, Buffer *out, size_t start,
+                       struct StatsTally *tally)
+{
+  STATS_COUNT(tally, SANITIZE_LIMITS_EXCEEDED);
+  if (!mode->limits.escape || (mode->limits.max_input && len > mode->limits.max_input))
+    return SANITIZE_LIMIT_EXCEEDED;
+
+  out->length = start;
+  html_write_text(out, html, len, 0);
+  buffer_reserve(out, 0);
+  out->data[out->length] = '\0';
+  return 0;
+}
 
+static int sanitize_to_buffer(const char *html, size_t len, struct sanitize_mode *mode, Buffer *out)
+{
+  struct StatsTally tally;
+  Trace storage, *trace = trace_begin(&mode->tracer, &storage, len, 0);
+  const size_t start = out->length;
+  htmlParserCtxtPtr ctxt;
+  Budget budget;
+  int result = 0;
+
+  begin_counting(&tally, len);
+  if (!budget_init(&budget, &mode->limits, len))
+    result = SANITIZE_LIMIT_EXCEEDED;
+  else if (!write_plain_text(html, len, out))
+    {
+      ctxt = new_parser(mode);
+      if (ctxt)
+        {
+          result = sanitize_with(ctxt, html, len, mode, out, &budget, &tally, trace);
+          htmlFreeParserCtxt(ctxt);
+        }
+      else
+        result = -1;
+    }
+  if (result == SANITIZE_LIMIT_EXCEEDED)
+    result = over_limits(mode, html, len, out, start, &tally);
+  stats_flush(mode->stats, &tally);
+  trace_end(&mode->tracer, trace, out->length - start, result);
   return result;
 }
 
+int sanitize_into(const char *html, struct sanitize_mode *mode, sanitize_buffer *out)
+{
+  return sanitize_into_n(html, strlen(html), mode, out);
+}
+
+int sanitize_into_n(const char *html, size_t len, struct sanitize_mode *mode, sanitize_buffer *out)
+{
+  int result = sanitize_to_buffer(html, len, mode, out);
+
+  return result < 0 ? result : 0;
+}
+
+char *sanitize_n(const char *html, size_t len, struct sanitize_mode *mode)
+{
+  Buffer out;
+
+  buffer_init(&out);
+  if (sanitize_to_buffer(html, len, mode, &out) < 0)
+    {
+      buffer_destroy(&out);
+      return NULL;
+    }
+  return out.data;
+}
+
+char *sanitize(const char *html, struct sanitize_mode *mode)
+{
+  return sanitize_n(html, strlen(html), mode);
+}
+
+
+/* reusable context */
+
+struct sanitize_ctx
+{
+  struct sanitize_mode *mode;
+  htmlParserCtxtPtr parser;     /* reset by every parse; its name dictionary is trimmed */
+  Buffer output;
+};
+
+struct sanitize_ctx *sanitize_ctx_new(struct sanitize_mode *mode)
+{
+  struct sanitize_ctx *ctx = malloc(sizeof(struct sanitize_ctx));
+
+  ctx->mode = mode;
+  ctx->parser = new_parser(mode);
+  if (!ctx->parser)
+    {
+      free(ctx);
+      return NULL;
+    }
+  buffer_init(&ctx->output);
+  return ctx;
+}
+
+void sanitize_ctx_free(struct sanitize_ctx *ctx)
+{
+  if (!ctx)
+    return;
+  htmlFreeParserCtxt(ctx->parser);
+  buffer_destroy(&ctx->output);
+  free(ctx);
+}
+
+const char *sanitize_ctx_run(struct sanitize_ctx *ctx, const char *html, size_t len)
+{
+  struct StatsTally tally;
+  Trace storage, *trace = trace_begin(&ctx->mode->tracer, &storage, len, 0);
+  Budget budget;
+  int result = 0;
+
+  buffer_clear(&ctx->output);
+  begin_counting(&tally, len);
+  if (!budget_init(&budget, &ctx->mode->limits, len))
+    result = SANITIZE_LIMIT_EXCEEDED;
+  else if (!write_plain_text(html, len, &ctx->output))
+    {
+      result = sanitize_with(ctx->parser, html, len, ctx->mode, &ctx->output, &budget, &tally, trace);
+      source_trim_names(ctx->parser, ctx->mode->names);
+    }
+  if (result == SANITIZE_LIMIT_EXCEEDED)
+    result = over_limits(ctx->mode, html, len, &ctx->output, 0, &tally);
+  stats_flush(ctx->mode->stats, &tally);
+  trace_end(&ctx->mode->tracer, trace, ctx->output.length, result);
+  return result < 0 ? NULL : ctx->output.data;
+}
@@ -1,9 +1,70 @@
 #ifndef SANITIZE_H_INCLUDED
 #define SANITIZE_H_INCLUDED
 
+#include <stddef.h>
 #include "mode.h"
+#include "mode_handle.h"
+#include "buffer.h"
 
+/*
+ * NULL when the input cannot be parsed or goes beyond the mode's limits.
+ * Input that cleans to nothing gives "", here as in every other call.
+ */
 char *sanitize(const char *html, struct sanitize_mode *mode);
 
+/* html is len bytes long and need not be NUL-terminated */
+char *sanitize_n(const char *html, size_t len, struct sanitize_mode *mode);
+
+/*
+ * Output into a buffer owned by the caller. The result is appended and
+ * NUL-terminated; the memory is kept, so a buffer cleared with
+ * buffer_clear() and reused stops allocating once it is large enough.
+ * Returns 0 on success, -1 when the input cannot be parsed, and
+ * SANITIZE_LIMIT_EXCEEDED when it goes beyond the mode's limits.
+ */
+
+typedef Buffer sanitize_buffer;
+
+int sanitize_into(const char *html, struct sanitize_mode *mode, sanitize_buffer *out);
+int sanitize_into_n(const char *html, size_t len, struct sanitize_mode *mode, sanitize_buffer *out);
+
+/*
+ * Reusable context for many calls with one mode, one context per thread.
+ * The parser and the output buffer are kept between calls. The result of
+ * sanitize_ctx_run() belongs to the context and stays valid until the
+ * next call; it is NULL when the input cannot be parsed.
+ */
+
+struct sanitize_ctx;
+
+struct sanitize_ctx *sanitize_ctx_new(struct sanitize_mode *mode);
+const char *sanitize_ctx_run(struct sanitize_ctx *ctx, const char *html, size_t len);
+void sanitize_ctx_free(struct sanitize_ctx *ctx);
+
+/*
+ * Sanitizes n inputs on a pool of threads (threads <= 0: one per CPU).
+ * lens may be NULL for NUL-terminated inputs. outputs[i] receives a
+ * malloc()ed result, or NULL when input i cannot be parsed; the call
+ * then returns -1.
+ */
+
+int sanitize_batch(const char **inputs, const size_t *lens, size_t n, struct sanitize_mode *mode, char **outputs, int threads);
+
+/*
+ * Streaming interface: the sanitized output is handed to write as it is
+ * produced, without building a document tree; memory grows with the
+ * nesting depth, not with the input. The output is the same as sanitize()
+ * gives, but for one newline: a block element whose first child is over
+ * 64 KiB and has siblings lacks the newline after its start tag. write returns a negative value to abort; the call
+ * then returns -1. Input beyond the mode's limits is never escaped here,
+ * as part of the output may already be written: the call returns
+ * SANITIZE_LIMIT_EXCEEDED.
+ */
+
+typedef int (*sanitize_write_function)(void *context, const char *data, size_t len);
+
+int sanitize_stream(const char *html, struct sanitize_mode *mode, sanitize_write_function write, void *context);
+int sanitize_stream_n(const char *html, size_t len, struct sanitize_mode *mode, sanitize_write_function write, void *context);
+
 #endif
 
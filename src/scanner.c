@@ -0,0 +1,294 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "scanner.h"
+#include "image.h"
+
+enum scanner_kind
+{
+  SCAN_PREFIXES,
+  SCAN_SCHEME
+};
+
+struct TrieNode
+{
+  unsigned char c;              /* lower case */
+  unsigned char terminal;
+  int child;
+  int sibling;
+};
+
+struct Scanner
+{
+  enum scanner_kind kind;
+
+  /* SCAN_PREFIXES */
+  struct TrieNode *nodes;       /* nodes[0] is the root */
+  int node_count;
+
+  /* SCAN_SCHEME: some `separator` after at least one byte and before any `stop` */
+  unsigned char stop;
+  unsigned char separator;
+};
+
+static const char METACHARACTERS[] = ".[]()*+?{}|^$\\";
+
+static unsigned char lower(unsigned char c)
+{
+  return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static int is_plain_symbol(unsigned char c)
+{
+  return c > 0x20 && c < 0x7f &&
+    !(c >= 'a' && c <= 'z') && !(c >= 'A' && c <= 'Z') && !(c >= '0' && c <= '9');
+}
+
+static int trie_child(Scanner *sc, int node, unsigned char c)
+{
+  int child;
+
+  for (child = sc->nodes[node].child; child; child = sc->nodes[child].sibling)
+    if (sc->nodes[child].c == c)
+      return child;
+
+  sc->nodes = realloc(sc->nodes, (sc->node_count + 1) * sizeof(struct TrieNode));
+  child = sc->node_count++;
+  sc->nodes[child].c = c;
+  sc->nodes[child].terminal = 0;
+  sc->nodes[child].child = 0;
+  sc->nodes[child].sibling = sc->nodes[node].child;
+  sc->nodes[node].child = child;
+  return child;
+}
+
+/* ^literal or ^(literal|literal|...) */
+static Scanner *compile_prefixes(const char *re)
+{
+  Scanner *sc;
+  const char *p = re + 1;
+  int grouped = 0, node = 0;
+
+  if (*p == '(')
+    {
+      grouped = 1;
+      ++p;
+    }
+
+  sc = calloc(1, sizeof(struct Scanner));
+  sc->kind = SCAN_PREFIXES;
+  sc->nodes = calloc(1, sizeof(struct TrieNode));
+  sc->node_count = 1;
+
+  for (;;)
+    {
+      unsigned char c = *p;
+
+      if (c == '\\' && p[1] && is_plain_symbol(p[1]))
+        {
+          node = trie_child(sc, node, (unsigned char)p[1]);
+          p += 2;
+        }
+      else if (c == '|' && grouped)
+        {
+          sc->nodes[node].terminal = 1;
+          node = 0;
+          ++p;
+        }
+      else if ((c == ')' && grouped && !p[1]) || (!c && !grouped))
+        {
+          sc->nodes[node].terminal = 1;
+          return sc;
+        }
+      else if (c && !strchr(METACHARACTERS, c))
+        {
+          node = trie_child(sc, node, lower(c));
+          ++p;
+        }
+      else
+        {
+          scanner_free(sc);
+          return NULL;
+        }
+    }
+}
+
+/* ^[^X]+Y or ^[^X]+[[:space:]]*Y */
+static Scanner *compile_scheme(const char *re)
+{
+  static const char SPACES[] = "[[:space:]]*";
+  Scanner *sc;
+  unsigned char stop, separator;
+
+  if (strncmp(re, "^[^", 3) || strncmp(re + 4, "]+", 2))
+    return NULL;
+  stop = re[3];
+  re += 6;
+  if (!strncmp(re, SPACES, sizeof(SPACES) - 1))
+    re += sizeof(SPACES) - 1;
+  separator = re[0];
+  if (re[0] && re[1])
+    return NULL;
+
+  if (!is_plain_symbol(stop) || strchr("]^-[", stop) ||
+      !is_plain_symbol(separator) || strchr(METACHARACTERS, separator) ||
+      stop == separator)
+    return NULL;
+
+  sc = calloc(1, sizeof(struct Scanner));
+  sc->kind = SCAN_SCHEME;
+  sc->stop = stop;
+  sc->separator = separator;
+  return sc;
+}
+
+Scanner *scanner_compile(const char *re)
+{
+  Scanner *sc;
+
+  if (!re || re[0] != '^')
+    return NULL;
+
+  sc = compile_prefixes(re);
+  if (!sc)
+    sc = compile_scheme(re);
+  return sc;
+}
+
+Scanner *scanner_freeze(Scanner *sc, Arena *arena)
+{
+  Scanner *copy = arena_alloc(arena, sizeof(struct Scanner));
+
+  *copy = *sc;
+  if (sc->nodes)
+    {
+      copy->nodes = arena_alloc(arena, sc->node_count * sizeof(struct TrieNode));
+      memcpy(copy->nodes, sc->nodes, sc->node_count * sizeof(struct TrieNode));
+    }
+  scanner_free(sc);
+  return copy;
+}
+
+struct ScannerImage
+{
+  uint32_t kind;
+  int32_t node_count;
+  image_offset nodes;
+  unsigned char stop;
+  unsigned char separator;
+};
+
+image_offset scanner_save(const Scanner *sc, ImageWriter *w)
+{
+  struct ScannerImage *image;
+  image_offset offset, nodes = 0;
+  int i;
+
+  if (sc->nodes)
+    {
+      struct TrieNode *copy;
+
+      /* field by field, so that no padding byte is left undefined */
+      nodes = image_reserve(w, sc->node_count * sizeof(struct TrieNode));
+      copy = image_record(w, nodes);
+      for (i = 0; i < sc->node_count; ++i)
+        {
+          copy[i].c = sc->nodes[i].c;
+          copy[i].terminal = sc->nodes[i].terminal;
+          copy[i].child = sc->nodes[i].child;
+          copy[i].sibling = sc->nodes[i].sibling;
+        }
+    }
+
+  offset = image_reserve(w, sizeof(struct ScannerImage));
+  image = image_record(w, offset);
+  image->kind = sc->kind;
+  image->node_count = sc->nodes ? sc->node_count : 0;
+  image->nodes = nodes;
+  image->stop = sc->stop;
+  image->separator = sc->separator;
+  return offset;
+}
+
+Scanner *scanner_load(Arena *arena, const ImageReader *r, image_offset offset)
+{
+  const struct ScannerImage *image = image_at(r, offset, sizeof(struct ScannerImage), 1);
+  const struct TrieNode *nodes = NULL;
+  Scanner *sc;
+  int i;
+
+  if (!image || (image->kind != SCAN_PREFIXES && image->kind != SCAN_SCHEME))
+    return NULL;
+
+  if (image->kind == SCAN_PREFIXES)
+    {
+      if (image->node_count < 1)
+        return NULL;
+      nodes = image_at(r, image->nodes, sizeof(struct TrieNode), image->node_count);
+      if (!nodes)
+        return NULL;
+      /* children come after their parent and siblings before each other, as trie_child() adds them */
+      for (i = 0; i < image->node_count; ++i)
+        if ((nodes[i].child && (nodes[i].child <= i || nodes[i].child >= image->node_count)) ||
+            nodes[i].sibling < 0 || nodes[i].sibling >= i + (i == 0))
+          return NULL;
+    }
+
+  sc = arena_alloc(arena, sizeof(struct Scanner));
+  sc->kind = image->kind;
+  sc->nodes = (struct TrieNode *)nodes;
+  sc->node_count = nodes ? image->node_count : 0;
+  sc->stop = image->stop;
+  sc->separator = image->separator;
+  return sc;
+}
+
+void scanner_free(Scanner *sc)
+{
+  if (!sc)
+    return;
+  free(sc->nodes);
+  free(sc);
+}
+
+int scanner_match(const Scanner *sc, const char *value)
+{
+  const unsigned char *p = (const unsigned char *)value;
+
+  switch (sc->kind)
+    {
+    case SCAN_PREFIXES:
+      {
+        int node = 0;
+
+        for (;;)
+          {
+            int child;
+
+            if (sc->nodes[node].terminal)
+              return 1;
+            if (!*p)
+              return 0;
+            for (child = sc->nodes[node].child; child; child = sc->nodes[child].sibling)
+              if (sc->nodes[child].c == lower(*p))
+                break;
+            if (!child)
+              return 0;
+            node = child;
+            ++p;
+          }
+      }
+
+    case SCAN_SCHEME:
+      for (; *p; ++p)
+        {
+          if (*p == sc->stop)
+            return 0;
+          if (*p == sc->separator && p != (const unsigned char *)value)
+            return 1;
+        }
+      return 0;
+    }
+
+  return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef SANITIZE_SCANNER_H_INCLUDED
+#define SANITIZE_SCANNER_H_INCLUDED
+
+/*
+ * Hand-written matchers for the pattern shapes that make up almost all
+ * attribute rules:
+ *
+ *   ^(ftp:|http:|https:|mailto:)   anchored literal prefixes (a trie)
+ *   ^[^/]+[[:space:]]*:            "has a scheme" detector
+ *
+ * Semantics are those of regexec() with REG_EXTENDED | REG_ICASE.
+ */
+
+#include "arena.h"
+#include "image.h"
+
+typedef struct Scanner Scanner;
+
+/* NULL unless re has one of the recognised shapes */
+Scanner *scanner_compile(const char *re);
+/* moves sc into the arena; the copy is not passed to scanner_free() */
+Scanner *scanner_freeze(Scanner *sc, Arena *arena);
+void scanner_free(Scanner *sc);
+
+/* the loaded scanner reads its trie from the image */
+image_offset scanner_save(const Scanner *sc, ImageWriter *w);
+Scanner *scanner_load(Arena *arena, const ImageReader *r, image_offset offset);
+int scanner_match(const Scanner *sc, const char *value);
+
+#endif
@@ -0,0 +1,85 @@
+#include <string.h>
+#include <libxml/parserInternals.h>
+
+#include "source.h"
+
+static int source_read(void *context, char *buffer, int len)
+{
+  Source *src = context;
+  int total = 0;
+
+  while (total < len && src->part < 3)
+    {
+      size_t count = src->lengths[src->part] - src->offset;
+
+      if (count > (size_t)(len - total))
+        count = len - total;
+      memcpy(buffer + total, src->parts[src->part] + src->offset, count);
+      total += count;
+      src->offset += count;
+      if (src->offset == src->lengths[src->part])
+        {
+          ++src->part;
+          src->offset = 0;
+        }
+    }
+  return total;
+}
+
+static int source_close(void *context)
+{
+  return 0;
+}
+
+void source_init(Source *src, const char *html, size_t len)
+{
+  src->parts[0] = "<div>";
+  src->lengths[0] = 5;
+  src->parts[1] = html;
+  src->lengths[1] = len;
+  src->parts[2] = "</div>";
+  src->lengths[2] = 6;
+  src->part = 0;
+  src->offset = 0;
+}
+
+static void use_sub_dictionary(htmlParserCtxtPtr ctxt, xmlDictPtr names)
+{
+  xmlDictPtr dict = xmlDictCreateSub(names);
+
+  if (!dict)
+    return;
+
+  /* what htmlNewParserCtxt() took from the dictionary it made */
+  xmlDictSetLimit(dict, XML_MAX_DICTIONARY_LIMIT);
+  ctxt->str_xml = xmlDictLookup(dict, BAD_CAST("xml"), 3);
+  ctxt->str_xmlns = xmlDictLookup(dict, BAD_CAST("xmlns"), 5);
+  ctxt->str_xml_ns = xmlDictLookup(dict, XML_XML_NAMESPACE, 36);
+  xmlDictFree(ctxt->dict);
+  ctxt->dict = dict;
+}
+
+htmlParserCtxtPtr source_new_parser(xmlDictPtr names)
+{
+  htmlParserCtxtPtr ctxt = htmlNewParserCtxt();
+
+  if (ctxt && names)
+    use_sub_dictionary(ctxt, names);
+  return ctxt;
+}
+
+void source_trim_names(htmlParserCtxtPtr ctxt, xmlDictPtr names)
+{
+  if (!names || xmlDictGetUsage(ctxt->dict) <= SOURCE_MAX_NAME_BYTES)
+    return;
+
+  /* the reset lets go of everything that points into the dictionary */
+  htmlCtxtReset(ctxt);
+  use_sub_dictionary(ctxt, names);
+}
+
+htmlDocPtr source_parse(Source *src, htmlParserCtxtPtr ctxt)
+{
+  return htmlCtxtReadIO(ctxt, source_read, source_close, src, NULL, "utf-8",
+                        HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING | HTML_PARSE_NONET);
+}
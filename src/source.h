@@ -0,0 +1,43 @@
+#ifndef SANITIZE_SOURCE_H_INCLUDED
+#define SANITIZE_SOURCE_H_INCLUDED
+
+#include <stddef.h>
+#include <libxml/HTMLparser.h>
+
+/*
+ * Parser input made of "<div>", the caller's bytes and "</div>", read in
+ * sequence, so the fragment never has to be copied to be wrapped.
+ */
+
+typedef struct Source Source;
+
+struct Source
+{
+  const char *parts[3];
+  size_t lengths[3];
+  size_t part;
+  size_t offset;
+};
+
+void source_init(Source *src, const char *html, size_t len);
+
+/*
+ * A parser context whose dictionary falls back to names (when not NULL):
+ * every tag and attribute name found there is handed out at the address
+ * it has in names.
+ */
+htmlParserCtxtPtr source_new_parser(xmlDictPtr names);
+
+/*
+ * Names found in the input are interned in the parser's own dictionary.
+ * A parser kept for many inputs gets a fresh one once they take more
+ * than SOURCE_MAX_NAME_BYTES; call it between parses.
+ */
+#define SOURCE_MAX_NAME_BYTES (64 * 1024)
+
+void source_trim_names(htmlParserCtxtPtr ctxt, xmlDictPtr names);
+
+/* parses the wrapped fragment with ctxt, as htmlReadDoc() would */
+htmlDocPtr source_parse(Source *src, htmlParserCtxtPtr ctxt);
+
+#endif
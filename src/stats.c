@@ -0,0 +1,122 @@
+#include <string.h>
+
+#include "stats.h"
+#include "common.h"
+
+static const char *const counter_names[SANITIZE_COUNTER_COUNT] = {
+  "documents",
+  "input-bytes",
+  "nodes-element",
+  "nodes-text",
+  "nodes-cdata",
+  "nodes-comment",
+  "nodes-other",
+  "elements-kept",
+  "elements-deleted",
+  "elements-renamed",
+  "elements-stripped",
+  "attributes-dropped-by-name",
+  "attributes-dropped-by-value",
+  "attributes-set",
+  "scanner-runs",
+  "matcher-runs",
+  "regexec-calls",
+  "limits-exceeded"
+};
+
+const char *sanitize_counter_name(enum sanitize_counter counter)
+{
+  return counter < SANITIZE_COUNTER_COUNT ? counter_names[counter] : NULL;
+}
+
+#ifndef SANITIZE_NO_STATS
+
+struct Stats
+{
+  char *shards;                 /* STATS_SHARDS of stride bytes, each on cache lines of its own */
+  size_t stride;
+};
+
+static unsigned next_shard = 0;
+static __thread unsigned thread_shard = 0;  /* index + 1, 0 until the thread first counts */
+
+void *stats_shards_new(Arena *arena, size_t size, size_t *stride)
+{
+  char *memory;
+
+  *stride = align_size_64(size);
+  memory = arena_calloc(arena, STATS_SHARDS * *stride + 64, 1);
+  return memory + (64 - (size_t)memory % 64) % 64;
+}
+
+Stats *stats_new(Arena *arena)
+{
+  Stats *stats = arena_alloc(arena, sizeof(struct Stats));
+
+  stats->shards = stats_shards_new(arena, sizeof(struct sanitize_stats), &stats->stride);
+  return stats;
+}
+
+void stats_tally_init(struct StatsTally *tally)
+{
+  if (!thread_shard)
+    thread_shard = __atomic_fetch_add(&next_shard, 1, __ATOMIC_RELAXED) % STATS_SHARDS + 1;
+  tally->shard = thread_shard - 1;
+  memset(tally->counters, 0, sizeof(tally->counters));
+  tally->tag_hits = NULL;
+  memset(tally->tags, 0, sizeof(tally->tags));
+}
+
+static void fold_tag(unsigned long long *hits, size_t slot, unsigned long long n)
+{
+  if (slot && n)
+    __atomic_add_fetch(&hits[slot - 1], n, __ATOMIC_RELAXED);
+}
+
+void stats_take_tag(struct StatsTally *tally, unsigned long long *hits, size_t slot)
+{
+  const size_t i = slot % STATS_TALLY_TAGS;
+
+  if (tally->tag_hits)
+    fold_tag(tally->tag_hits, tally->tags[i].slot, tally->tags[i].hits);
+  tally->tag_hits = hits;
+  tally->tags[i].slot = slot + 1;
+  tally->tags[i].hits = 0;
+}
+
+void stats_flush(Stats *stats, const struct StatsTally *tally)
+{
+  struct sanitize_stats *shard;
+  size_t i;
+
+  if (tally->tag_hits)
+    for (i = 0; i < STATS_TALLY_TAGS; ++i)
+      fold_tag(tally->tag_hits, tally->tags[i].slot, tally->tags[i].hits);
+  if (!stats)
+    return;
+  shard = (struct sanitize_stats *)(stats->shards + tally->shard * stats->stride);
+  for (i = 0; i < SANITIZE_COUNTER_COUNT; ++i)
+    if (tally->counters[i])
+      __atomic_add_fetch(&shard->counters[i], tally->counters[i], __ATOMIC_RELAXED);
+}
+
+#endif
+
+void stats_snapshot(const Stats *stats, struct sanitize_stats *out)
+{
+  memset(out, 0, sizeof(struct sanitize_stats));
+#ifndef SANITIZE_NO_STATS
+  {
+    size_t s, i;
+
+    if (!stats)
+      return;
+    for (s = 0; s < STATS_SHARDS; ++s)
+      {
+        const struct sanitize_stats *shard = (const struct sanitize_stats *)(stats->shards + s * stats->stride);
+        for (i = 0; i < SANITIZE_COUNTER_COUNT; ++i)
+          out->counters[i] += __atomic_load_n(&shard->counters[i], __ATOMIC_RELAXED);
+      }
+  }
+#endif
+}
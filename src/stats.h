@@ -0,0 +1,105 @@
+#ifndef SANITIZE_STATS_H_INCLUDED
+#define SANITIZE_STATS_H_INCLUDED
+
+#include <stddef.h>
+#include "arena.h"
+
+/* what the calls on a mode did, summed over all threads */
+
+enum sanitize_counter
+{
+  SANITIZE_DOCUMENTS,
+  SANITIZE_INPUT_BYTES,
+  SANITIZE_NODES_ELEMENT,       /* nodes visited; the streaming engine counts parser events */
+  SANITIZE_NODES_TEXT,
+  SANITIZE_NODES_CDATA,
+  SANITIZE_NODES_COMMENT,
+  SANITIZE_NODES_OTHER,
+  SANITIZE_ELEMENTS_KEPT,
+  SANITIZE_ELEMENTS_DELETED,    /* with their children */
+  SANITIZE_ELEMENTS_RENAMED,    /* once per step of a chain */
+  SANITIZE_ELEMENTS_STRIPPED,   /* unknown, or renamed to whitespace: the children stay */
+  SANITIZE_ATTRIBUTES_DROPPED_BY_NAME,
+  SANITIZE_ATTRIBUTES_DROPPED_BY_VALUE,
+  SANITIZE_ATTRIBUTES_SET,      /* mandatory values put in place */
+  SANITIZE_SCANNER_RUNS,
+  SANITIZE_MATCHER_RUNS,
+  SANITIZE_REGEXEC_CALLS,
+  SANITIZE_LIMITS_EXCEEDED,     /* calls stopped by the mode's limits */
+  SANITIZE_COUNTER_COUNT
+};
+
+struct sanitize_stats
+{
+  unsigned long long counters[SANITIZE_COUNTER_COUNT];
+};
+
+const char *sanitize_counter_name(enum sanitize_counter counter);
+
+/*
+ * A call counts into a tally of its own and adds it to the mode's
+ * counters once, at the end, in the shard of the calling thread. Threads
+ * get shards in turn; those that end up sharing one add atomically, but
+ * never contend for a cache line with the others.
+ *
+ * Per-tag hits go the same way: the tally keeps a few of them, by slot
+ * modulo STATS_TALLY_TAGS, and adds one to the shard only when another
+ * tag takes its place or at the flush.
+ *
+ * Built with SANITIZE_NO_STATS, counting compiles to nothing and the
+ * counters stay at zero.
+ */
+
+#define STATS_SHARDS (8)
+#define STATS_TALLY_TAGS (32)
+
+typedef struct Stats Stats;
+
+struct StatsTally
+{
+  unsigned shard;
+  unsigned long long counters[SANITIZE_COUNTER_COUNT];
+  unsigned long long *tag_hits; /* the shard's counter per tag slot */
+  struct
+  {
+    size_t slot;                /* slot + 1, 0 when unused */
+    unsigned long long hits;
+  } tags[STATS_TALLY_TAGS];
+};
+
+#ifdef SANITIZE_NO_STATS
+
+#define STATS_ADD(tally, counter, n) ((void)0)
+
+static inline Stats *stats_new(Arena *arena) { return NULL; }
+static inline void stats_tally_init(struct StatsTally *tally) { tally->shard = 0; }
+static inline void stats_flush(Stats *stats, const struct StatsTally *tally) {}
+
+#else
+
+#define STATS_ADD(tally, counter, n) ((tally)->counters[counter] += (n))
+
+Stats *stats_new(Arena *arena);
+void stats_tally_init(struct StatsTally *tally);
+void stats_flush(Stats *stats, const struct StatsTally *tally);
+
+void stats_take_tag(struct StatsTally *tally, unsigned long long *hits, size_t slot);
+
+/* hits: the counters of the tally's shard, one per slot */
+static inline void stats_count_tag(struct StatsTally *tally, unsigned long long *hits, size_t slot)
+{
+  if (tally->tags[slot % STATS_TALLY_TAGS].slot != slot + 1)
+    stats_take_tag(tally, hits, slot);
+  ++tally->tags[slot % STATS_TALLY_TAGS].hits;
+}
+
+/* STATS_SHARDS zeroed blocks of at least size bytes, *stride apart and cache-line aligned */
+void *stats_shards_new(Arena *arena, size_t size, size_t *stride);
+
+#endif
+
+#define STATS_COUNT(tally, counter) STATS_ADD(tally, counter, 1)
+
+void stats_snapshot(const Stats *stats, struct sanitize_stats *out);
+
+#endif
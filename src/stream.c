@@ -0,0 +1,598 @@
+#include <stdlib.h>
+#include <string.h>
+#include <libxml/HTMLparser.h>
+#include <libxml/HTMLtree.h>
+#include <libxml/parserInternals.h>
+
+#include "sanitize.h"
+#include "buffer.h"
+#include "html_writer.h"
+#include "source.h"
+#include "prescan.h"
+
+/*
+ * Streaming engine: the same rules as sanitize(), applied to the SAX
+ * events of libxml2's HTML parser. No tree is built; state is one entry
+ * per open element.
+ *
+ * The output is byte-identical to sanitize(), including the newlines
+ * htmlNodeDumpOutput() puts around block elements. Most of those only
+ * depend on what was already written, except the one after the start tag
+ * of a block element, which needs to know whether a second child follows;
+ * the first child of such an element is held back until that is known.
+ *
+ * Two exceptions keep the memory of a call proportional to the nesting
+ * depth rather than to the input:
+ *
+ * - A first child is only held until it reaches HOLD_SIZE bytes. It is
+ *   then written out as if it were the only child, so a block element
+ *   whose first child is that large and has siblings misses the newline
+ *   after its start tag.
+ *
+ * - Like the tree builder, the engine stops at xmlParserMaxDepth open
+ *   elements (the html, body and div around the fragment included):
+ *   what follows is dropped, and the open elements are closed.
+ */
+
+#define FLUSH_SIZE (4096)
+#define HOLD_SIZE (65536)
+
+enum child_kind
+{
+  CHILD_TEXT,
+  CHILD_ELEMENT,
+  CHILD_COMMENT
+};
+
+enum input_kind
+{
+  INPUT_WRAPPER,                /* html, body and the wrapping div */
+  INPUT_KEEP,
+  INPUT_STRIP,
+  INPUT_WHITESPACE
+};
+
+struct InputElement
+{
+  enum input_kind kind;
+  size_t children_before;       /* INPUT_WHITESPACE: output children when it started */
+};
+
+struct OutputElement
+{
+  const char *name;             /* NULL for the top level */
+  const htmlElemDesc *info;
+  size_t children;
+  enum child_kind last;
+  int block_before;             /* last child is a block element: a newline may follow it */
+  int held;                     /* first child sits in its own buffer */
+  int suppressed;               /* inside an empty element: nothing is written */
+};
+
+struct Streamer
+{
+  struct sanitize_mode *mode;
+  sanitize_write_function write;
+  void *context;
+  htmlParserCtxtPtr parser;
+
+  struct InputElement *input;
+  size_t input_depth, input_allocated;
+  size_t skip_depth;            /* inside a deleted element */
+  int done;                     /* the wrapping div is closed */
+
+  struct OutputElement *output;
+  size_t output_depth, output_allocated;
+
+  Buffer *buffers;              /* [0] goes to write, the rest are held first children */
+  size_t buffer_count, buffers_allocated;
+
+  int failed;
+  size_t written;               /* bytes handed to write */
+  struct StatsTally tally;
+  Budget budget;
+};
+
+/* output */
+
+static Buffer *current_buffer(struct Streamer *st)
+{
+  return &st->buffers[st->buffer_count - 1];
+}
+
+/* 0 once the input goes beyond the mode's limits, and the parser is stopped */
+static int charge(struct Streamer *st, int charged)
+{
+  if (!charged)
+    {
+      st->failed = 1;
+      xmlStopParser(st->parser);
+    }
+  return charged;
+}
+
+static struct OutputElement *current_output(struct Streamer *st);
+static void release(struct Streamer *st, int newline);
+
+/* held children too large to wait for a sibling are written as the only one */
+static void stop_holding(struct Streamer *st)
+{
+  size_t i;
+
+  for (i = st->output_depth; i-- > 0 && st->buffer_count > 1; )
+    if (st->output[i].held)
+      {
+        release(st, 0);
+        st->output[i].held = 0;
+      }
+}
+
+static void flush(struct Streamer *st, int force)
+{
+  Buffer *out = &st->buffers[0];
+
+  if (st->buffer_count > 1 && current_buffer(st)->length > HOLD_SIZE)
+    stop_holding(st);
+  if (st->failed || st->buffer_count != 1 || !out->length || (!force && out->length < FLUSH_SIZE))
+    return;
+
+  st->written += out->length;
+  if (st->write(st->context, out->data, out->length) < 0)
+    {
+      st->failed = 1;
+      xmlStopParser(st->parser);
+    }
+  out->length = 0;
+}
+
+static void hold(struct Streamer *st)
+{
+  if (st->buffer_count == st->buffers_allocated)
+    {
+      st->buffers_allocated *= 2;
+      st->buffers = realloc(st->buffers, st->buffers_allocated * sizeof(Buffer));
+    }
+  buffer_init(&st->buffers[st->buffer_count++]);
+}
+
+static void release(struct Streamer *st, int newline)
+{
+  Buffer held = st->buffers[--st->buffer_count];
+  Buffer *out = current_buffer(st);
+
+  if (newline)
+    buffer_append_char(out, '\n');
+  buffer_append(out, held.data, held.length);
+  buffer_destroy(&held);
+}
+
+static struct OutputElement *current_output(struct Streamer *st)
+{
+  return &st->output[st->output_depth - 1];
+}
+
+/* bookkeeping before a child is written; returns 0 when it must not be written */
+static int begin_child(struct Streamer *st, enum child_kind kind)
+{
+  struct OutputElement *parent = current_output(st);
+  const int named = parent->name && parent->name[0] != 'p';  /* p, pre, param never get newlines */
+
+  if (parent->suppressed)
+    return 0;
+
+  if (parent->held && parent->children == 1)
+    {
+      release(st, 1);
+      parent->held = 0;
+    }
+
+  if (parent->block_before && kind != CHILD_TEXT && named)
+    buffer_append_char(current_buffer(st), '\n');
+  parent->block_before = 0;
+
+  if (!parent->children && kind != CHILD_TEXT && named &&
+      parent->info && !parent->info->isinline)
+    {
+      hold(st);
+      parent->held = 1;
+    }
+
+  ++parent->children;
+  parent->last = kind;
+  return 1;
+}
+
+static void write_text(struct Streamer *st, const char *text, size_t len)
+{
+  if (begin_child(st, CHILD_TEXT))
+    html_write_text(current_buffer(st), text, len, html_is_raw_text_element(current_output(st)->name));
+}
+
+static void push_output(struct Streamer *st, const char *name, int suppressed)
+{
+  struct OutputElement *element;
+
+  if (st->output_depth == st->output_allocated)
+    {
+      st->output_allocated *= 2;
+      st->output = realloc(st->output, st->output_allocated * sizeof(struct OutputElement));
+    }
+
+  element = &st->output[st->output_depth++];
+  element->name = name;
+  element->info = name ? htmlTagLookup(BAD_CAST(name)) : NULL;
+  element->children = 0;
+  element->last = CHILD_TEXT;
+  element->block_before = 0;
+  element->held = 0;
+  element->suppressed = suppressed || (element->info && element->info->empty);
+}
+
+static void open_element(struct Streamer *st, const struct TagAction *action, const xmlChar **atts)
+{
+  const xmlChar **att;
+  Buffer *out;
+  const struct MandatoryAttribute *mandatory;
+  size_t mandatory_count, i;
+  unsigned long long present = 0;
+
+  if (!begin_child(st, CHILD_ELEMENT))
+    {
+      push_output(st, action->name, 1);
+      return;
+    }
+
+  out = current_buffer(st);
+  buffer_append_char(out, '<');
+  buffer_append_string(out, action->name);
+
+  mandatory_count = element_sanitizer_get_mandatory_attributes(action->sanitizer, &mandatory);
+
+  for (att = atts; att && att[0]; att += 2)
+    {
+      const char *name = (const char *)att[0];
+      const char *value = (const char *)att[1];
+      ValueChecker *checker = element_sanitizer_get_checker_interned(action->sanitizer, name);
+
+      if (!checker)
+        {
+          STATS_COUNT(&st->tally, SANITIZE_ATTRIBUTES_DROPPED_BY_NAME);
+          continue;
+        }
+      if (!value_checker_check(checker, value, &st->tally))
+        {
+          STATS_COUNT(&st->tally, SANITIZE_ATTRIBUTES_DROPPED_BY_VALUE);
+          continue;
+        }
+
+      for (i = 0; i < mandatory_count; ++i)
+        if (!strcmp(mandatory[i].name, name))
+          {
+            STATS_COUNT(&st->tally, SANITIZE_ATTRIBUTES_SET);
+            value = mandatory[i].value;
+            present |= 1ULL << i;
+            break;
+          }
+
+      html_write_attribute(out, action->name, name, value);
+    }
+
+  for (i = 0; i < mandatory_count; ++i)
+    if (!(present & (1ULL << i)))
+      {
+        STATS_COUNT(&st->tally, SANITIZE_ATTRIBUTES_SET);
+        html_write_attribute(out, action->name, mandatory[i].name, mandatory[i].value);
+      }
+
+  buffer_append_char(out, '>');
+
+  push_output(st, action->name, 0);
+}
+
+static void close_element(struct Streamer *st)
+{
+  struct OutputElement *element = current_output(st);
+  struct OutputElement *parent = element - 1;
+  const htmlElemDesc *info = element->info;
+  Buffer *out;
+
+  if (parent->suppressed)
+    {
+      --st->output_depth;
+      return;
+    }
+
+  if (element->held)
+    release(st, 0);
+
+  out = current_buffer(st);
+
+  /* end tags are omitted for empty elements, and for childless ones that allow it */
+  if (!info || !(info->empty || (!element->children && info->saveEndTag &&
+                                 strcmp(element->name, "html") && strcmp(element->name, "body"))))
+    {
+      if (info && !info->isinline && element->last != CHILD_TEXT &&
+          element->children > 1 && element->name[0] != 'p')
+        buffer_append_char(out, '\n');
+      buffer_append(out, "</", 2);
+      buffer_append_string(out, element->name);
+      buffer_append_char(out, '>');
+    }
+
+  parent->block_before = info && !info->isinline;
+  --st->output_depth;
+}
+
+/* SAX callbacks */
+
+static const struct TagAction *resolve(struct Streamer *st, const char *name, int *whitespace)
+{
+  const TagTable *tags = st->mode->tags;
+  const struct TagAction *action = tag_table_lookup_interned(tags, name);
+  int renames = 0;
+
+  *whitespace = 0;
+  while (action && action->kind == TAG_RENAME)
+    {
+      tag_table_count(tags, action, &st->tally);
+      if (action->rename_to == Q_WHITESPACE)
+        {
+          *whitespace = 1;
+          return action;
+        }
+      if (++renames > TAG_MAX_RENAMES)
+        return NULL;
+      STATS_COUNT(&st->tally, SANITIZE_ELEMENTS_RENAMED);
+      action = tag_table_lookup(tags, action->rename_to);
+    }
+  if (action)
+    tag_table_count(tags, action, &st->tally);
+  return action;
+}
+
+static void on_end_element(void *ctx, const xmlChar *name);
+
+/* past the tree builder's depth limit: the rest of the input is dropped */
+static void halt(struct Streamer *st)
+{
+  xmlStopParser(st->parser);
+  while (!st->done && (st->input_depth || st->skip_depth))
+    on_end_element(st, NULL);
+  st->done = 1;
+}
+
+static void on_start_element(void *ctx, const xmlChar *name, const xmlChar **atts)
+{
+  struct Streamer *st = ctx;
+  struct InputElement *element;
+  const struct TagAction *action;
+  int whitespace;
+
+  if (st->done)
+    return;
+  if (st->input_depth + st->skip_depth > xmlParserMaxDepth)
+    {
+      halt(st);
+      return;
+    }
+  if ((st->skip_depth || st->input_depth >= 3) && !charge(st, budget_start_element(&st->budget, atts)))
+    return;
+  if (st->skip_depth)
+    {
+      ++st->skip_depth;
+      return;
+    }
+
+  if (st->input_depth == st->input_allocated)
+    {
+      st->input_allocated *= 2;
+      st->input = realloc(st->input, st->input_allocated * sizeof(struct InputElement));
+    }
+  element = &st->input[st->input_depth++];
+
+  if (st->input_depth <= 3)
+    {
+      element->kind = INPUT_WRAPPER;
+      return;
+    }
+
+  STATS_COUNT(&st->tally, SANITIZE_NODES_ELEMENT);
+  action = resolve(st, (const char *)name, &whitespace);
+
+  if (whitespace)
+    {
+      STATS_COUNT(&st->tally, SANITIZE_ELEMENTS_STRIPPED);
+      element->kind = INPUT_WHITESPACE;
+      write_text(st, " ", 1);
+      element->children_before = current_output(st)->children;
+    }
+  else if (!action)
+    {
+      STATS_COUNT(&st->tally, SANITIZE_ELEMENTS_STRIPPED);
+      element->kind = INPUT_STRIP;
+    }
+  else if (action->kind == TAG_DELETE)
+    {
+      STATS_COUNT(&st->tally, SANITIZE_ELEMENTS_DELETED);
+      --st->input_depth;
+      st->skip_depth = 1;
+    }
+  else
+    {
+      STATS_COUNT(&st->tally, SANITIZE_ELEMENTS_KEPT);
+      element->kind = INPUT_KEEP;
+      open_element(st, action, atts);
+    }
+
+  flush(st, 0);
+}
+
+static void on_end_element(void *ctx, const xmlChar *name)
+{
+  struct Streamer *st = ctx;
+  struct InputElement *element;
+
+  if (st->done)
+    return;
+  if (st->skip_depth || st->input_depth > 3)
+    budget_end_element(&st->budget);
+  if (st->skip_depth)
+    {
+      --st->skip_depth;
+      return;
+    }
+  if (!st->input_depth)
+    return;
+
+  element = &st->input[--st->input_depth];
+
+  switch (element->kind)
+    {
+    case INPUT_WRAPPER:
+      if (st->input_depth == 2)
+        st->done = 1;
+      break;
+
+    case INPUT_KEEP:
+      close_element(st);
+      break;
+
+    case INPUT_STRIP:
+      break;
+
+    case INPUT_WHITESPACE:
+      if (current_output(st)->children > element->children_before)
+        write_text(st, " ", 1);
+      break;
+    }
+
+  flush(st, 0);
+}
+
+static void on_characters(void *ctx, const xmlChar *ch, int len)
+{
+  struct Streamer *st = ctx;
+
+  if (st->done || (!st->skip_depth && st->input_depth < 3) || len <= 0 || !charge(st, budget_node(&st->budget)))
+    return;
+  if (st->skip_depth)
+    return;
+
+  STATS_COUNT(&st->tally, SANITIZE_NODES_TEXT);
+  write_text(st, (const char *)ch, len);
+  flush(st, 0);
+}
+
+static void on_comment(void *ctx, const xmlChar *value)
+{
+  struct Streamer *st = ctx;
+
+  if (st->done || (!st->skip_depth && st->input_depth < 3) || !charge(st, budget_node(&st->budget)))
+    return;
+  if (st->skip_depth)
+    return;
+  STATS_COUNT(&st->tally, SANITIZE_NODES_COMMENT);
+  if (!st->mode->allow_comments)
+    return;
+
+  if (begin_child(st, CHILD_COMMENT))
+    html_write_comment(current_buffer(st), (const char *)value, strlen((const char *)value));
+  flush(st, 0);
+}
+
+static void on_ignorable_whitespace(void *ctx, const xmlChar *ch, int len)
+{
+  /* the tree builder drops these as well */
+}
+
+/* API */
+
+int sanitize_stream_n(const char *html, size_t len, struct sanitize_mode *mode, sanitize_write_function write, void *context)
+{
+  struct Streamer st;
+  Trace storage, *trace = trace_begin(&mode->tracer, &storage, len, 1);
+  Source src;
+  size_t i;
+  int result;
+
+  memset(&st, 0, sizeof(st));
+  st.mode = mode;
+  st.write = write;
+  st.context = context;
+
+  st.input_allocated = 16;
+  st.input = malloc(st.input_allocated * sizeof(struct InputElement));
+  st.output_allocated = 16;
+  st.output = malloc(st.output_allocated * sizeof(struct OutputElement));
+  st.buffers_allocated = 4;
+  st.buffers = malloc(st.buffers_allocated * sizeof(Buffer));
+  st.buffer_count = 1;
+  buffer_init(&st.buffers[0]);
+  stats_tally_init(&st.tally);
+  STATS_COUNT(&st.tally, SANITIZE_DOCUMENTS);
+  STATS_ADD(&st.tally, SANITIZE_INPUT_BYTES, len);
+
+  push_output(&st, NULL, 0);     /* top level */
+
+  if (!budget_init(&st.budget, &mode->limits, len))
+    {
+      st.failed = 1;
+      goto done;
+    }
+
+  if (prescan_is_plain_text(html, len))
+    {
+      /* a single text node: no need for the parser */
+      for (i = 0; i < len && !st.failed; i += FLUSH_SIZE)
+        {
+          html_write_text(&st.buffers[0], html + i, len - i < FLUSH_SIZE ? len - i : FLUSH_SIZE, 0);
+          flush(&st, 0);
+        }
+      goto done;
+    }
+
+  source_init(&src, html, len);
+
+  /* the same pull parser as htmlReadDoc(), reporting to the callbacks above */
+  st.parser = source_new_parser(mode->names);
+  if (st.parser)
+    {
+      memset(st.parser->sax, 0, sizeof(xmlSAXHandler));
+      st.parser->sax->startElement = on_start_element;
+      st.parser->sax->endElement = on_end_element;
+      st.parser->sax->characters = on_characters;
+      st.parser->sax->cdataBlock = on_characters;
+      st.parser->sax->ignorableWhitespace = on_ignorable_whitespace;
+      st.parser->sax->comment = on_comment;
+      st.parser->userData = &st;
+
+      source_parse(&src, st.parser);
+      htmlFreeParserCtxt(st.parser);
+    }
+  else
+    st.failed = 1;
+
+ done:
+  while (st.buffer_count > 1)
+    release(&st, 0);
+  flush(&st, 1);
+
+  result = st.budget.exceeded ? SANITIZE_LIMIT_EXCEEDED : st.failed ? -1 : 0;
+  if (st.budget.exceeded)
+    STATS_COUNT(&st.tally, SANITIZE_LIMITS_EXCEEDED);
+  stats_flush(mode->stats, &st.tally);
+  trace_end(&mode->tracer, trace, st.written, result);
+
+  for (i = 0; i < st.buffer_count; ++i)
+    buffer_destroy(&st.buffers[i]);
+  free(st.buffers);
+  free(st.output);
+  free(st.input);
+
+  return result;
+}
+
+int sanitize_stream(const char *html, struct sanitize_mode *mode, sanitize_write_function write, void *context)
+{
+  return sanitize_stream_n(html, strlen(html), mode, write, context);
+}
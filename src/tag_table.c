@@ -0,0 +1,501 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "tag_table.h"
+#include "name_index.h"
+#include "quarks.h"
+
+/*
+ * Hash-and-displace perfect hashing. Every key is hashed once; the hash
+ * selects a bucket, and the bucket's seed scrambles the hash into a slot.
+ * Seeds are chosen at build time so that no two keys share a slot.
+ * Names that no seed keeps apart, both hashes alike, are looked up by
+ * name in a Dict instead.
+ */
+
+#define MAX_SEED_ATTEMPTS (1 << 16)
+
+struct Slot
+{
+  char *name;
+  size_t name_len;
+  struct TagAction action;
+};
+
+struct TagTable
+{
+  Arena *arena;
+  unsigned bucket_count;
+  unsigned *seeds;
+  unsigned slot_mask;
+  struct Slot *slots;
+  NameIndex *interned;          /* interned name --> &slot->action */
+  Dict *by_name;                /* name --> &slot->action, when the hashing failed */
+  char *hits;                   /* per stats shard, a counter per slot */
+  size_t hits_stride;
+};
+
+struct Key
+{
+  const char *name;
+  size_t name_len;
+  unsigned hash;
+  unsigned hash2;
+  struct TagAction action;
+};
+
+/* two independent hashes in one pass, so that no pair of keys is inseparable */
+static unsigned hash_name(const char *name, size_t *len, unsigned *hash2)
+{
+  unsigned hash = 2166136261u, h2 = 5381;
+  const unsigned char *p;
+
+  for (p = (const unsigned char *)name; *p; ++p)
+    {
+      hash = (hash ^ *p) * 16777619u;
+      h2 = h2 * 33 + *p;
+    }
+
+  *len = p - (const unsigned char *)name;
+  *hash2 = h2 + (unsigned)*len;
+  return hash;
+}
+
+static unsigned scramble(unsigned hash, unsigned hash2, unsigned seed)
+{
+  hash ^= (hash2 << 7 | hash2 >> 25) + seed * 0x9e3779b9u;
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+static unsigned bucket_of(unsigned hash, unsigned bucket_count)
+{
+  return (hash ^ (hash >> 15)) % bucket_count;
+}
+
+static void collect(Array *keys, Dict *dict, enum tag_action_kind kind)
+{
+  Array *names;
+  size_t i, j;
+
+  if (!dict)
+    return;
+
+  names = dict_keys(dict);
+  for (i = 0; i < names->size; ++i)
+    {
+      const char *name = names->items[i];
+      struct Key *key = NULL;
+
+      /* earlier sections take precedence: elements, then delete, then rename */
+      for (j = 0; j < keys->size; ++j)
+        if (!strcmp(((struct Key *)keys->items[j])->name, name))
+          {
+            key = keys->items[j];
+            break;
+          }
+      if (key)
+        continue;
+
+      key = malloc(sizeof(struct Key));
+      key->name = strdup(name);
+      key->hash = hash_name(key->name, &key->name_len, &key->hash2);
+      key->action.kind = kind;
+      key->action.sanitizer = NULL;
+      key->action.rename_to = NULL;
+      if (kind == TAG_ALLOW)
+        key->action.sanitizer = dict_get(dict, name);
+      else if (kind == TAG_RENAME)
+        key->action.rename_to = dict_get(dict, name);
+      array_append(keys, key);
+    }
+  array_free(names);
+}
+
+static void free_key(struct Key *key)
+{
+  free((char *)key->name);
+  free(key);
+}
+
+static int bucket_size_greater(const void *a, const void *b)
+{
+  const Array *x = *(Array * const *)a, *y = *(Array * const *)b;
+  return (x->size < y->size) - (x->size > y->size);
+}
+
+static void fill_slot(struct Slot *slot, const struct Key *key)
+{
+  slot->name = (char *)key->name;
+  slot->name_len = key->name_len;
+  slot->action = key->action;
+  slot->action.name = slot->name;
+}
+
+/* returns 1 when every bucket found a collision-free seed */
+static int place(TagTable *table, Array *keys)
+{
+  Array **buckets;
+  unsigned *taken, *trial;
+  unsigned b, i, k;
+  int ok = 1;
+
+  buckets = malloc(table->bucket_count * sizeof(Array *));
+  for (b = 0; b < table->bucket_count; ++b)
+    buckets[b] = array_new(NULL);
+  for (k = 0; k < keys->size; ++k)
+    {
+      struct Key *key = keys->items[k];
+      array_append(buckets[bucket_of(key->hash, table->bucket_count)], key);
+    }
+
+  /* remember which bucket each array came from before sorting */
+  {
+    Array *order = array_new(NULL);
+    for (b = 0; b < table->bucket_count; ++b)
+      {
+        array_append(buckets[b], (void *)(size_t)b);  /* bucket index rides at the end */
+        array_append(order, buckets[b]);
+      }
+    qsort(order->items, order->size, sizeof(void *), bucket_size_greater);
+    memcpy(buckets, order->items, table->bucket_count * sizeof(Array *));
+    array_free(order);
+  }
+
+  taken = calloc(table->slot_mask + 1, sizeof(unsigned));
+  trial = malloc(keys->size * sizeof(unsigned) + 1);
+
+  for (b = 0; b < table->bucket_count && ok; ++b)
+    {
+      Array *bucket = buckets[b];
+      const size_t count = bucket->size - 1;
+      const unsigned index = (unsigned)(size_t)bucket->items[count];
+      unsigned seed;
+
+      if (!count)
+        break;                  /* sorted by size: the rest are empty */
+
+      for (seed = 1; seed < MAX_SEED_ATTEMPTS; ++seed)
+        {
+          for (i = 0; i < count; ++i)
+            {
+              const struct Key *key = bucket->items[i];
+              unsigned j;
+
+              trial[i] = scramble(key->hash, key->hash2, seed) & table->slot_mask;
+              if (taken[trial[i]])
+                break;
+              for (j = 0; j < i; ++j)
+                if (trial[j] == trial[i])
+                  break;
+              if (j < i)
+                break;
+            }
+          if (i == count)
+            break;
+        }
+
+      if (seed == MAX_SEED_ATTEMPTS)
+        {
+          ok = 0;
+          break;
+        }
+
+      table->seeds[index] = seed;
+      for (i = 0; i < count; ++i)
+        {
+          taken[trial[i]] = 1;
+          fill_slot(&table->slots[trial[i]], bucket->items[i]);
+        }
+    }
+
+  free(trial);
+  free(taken);
+  for (b = 0; b < table->bucket_count; ++b)
+    array_free(buckets[b]);
+  free(buckets);
+  return ok;
+}
+
+static void index_by_name(TagTable *table)
+{
+  unsigned i;
+
+  table->by_name = dict_new_in(table->arena);
+  for (i = 0; i <= table->slot_mask; ++i)
+    if (table->slots[i].name)
+      dict_replace(table->by_name, table->slots[i].name, &table->slots[i].action);
+}
+
+static void init_hits(TagTable *table)
+{
+#ifndef SANITIZE_NO_STATS
+  table->hits = stats_shards_new(table->arena, (table->slot_mask + 1) * sizeof(unsigned long long),
+                                 &table->hits_stride);
+#else
+  table->hits = NULL;
+#endif
+}
+
+TagTable *tag_table_build(Arena *arena, Dict *elements, Dict *delete_elements, Dict *rename_elements)
+{
+  TagTable *table;
+  Array *keys;
+  unsigned slot_count, i;
+  int hashed = 1;
+
+  keys = array_new((free_function_t)free_key);
+  collect(keys, elements, TAG_ALLOW);
+  collect(keys, delete_elements, TAG_DELETE);
+  collect(keys, rename_elements, TAG_RENAME);
+
+  table = arena_alloc(arena, sizeof(struct TagTable));
+  table->arena = arena;
+  table->bucket_count = keys->size / 2 + 1;
+  table->seeds = arena_calloc(arena, table->bucket_count, sizeof(unsigned));
+  table->interned = NULL;
+  table->by_name = NULL;
+
+  for (slot_count = 2; slot_count < 2 * keys->size; slot_count *= 2)
+    ;
+
+  for (;;)
+    {
+      table->slot_mask = slot_count - 1;
+      table->slots = calloc(slot_count, sizeof(struct Slot));
+      if (place(table, keys))
+        break;
+      memset(table->seeds, 0, table->bucket_count * sizeof(unsigned));
+      if (slot_count > 8 * keys->size)
+        {
+          /* more room does not help names that hash alike */
+          memset(table->slots, 0, slot_count * sizeof(struct Slot));
+          for (i = 0; i < keys->size; ++i)
+            fill_slot(&table->slots[i], keys->items[i]);
+          hashed = 0;
+          break;
+        }
+      free(table->slots);
+      slot_count *= 2;
+    }
+
+  /* the slots and their names move into the arena once placed */
+  {
+    struct Slot *slots = arena_alloc(arena, slot_count * sizeof(struct Slot));
+
+    memcpy(slots, table->slots, slot_count * sizeof(struct Slot));
+    free(table->slots);
+    table->slots = slots;
+    for (i = 0; i < slot_count; ++i)
+      if (slots[i].name)
+        {
+          slots[i].name = arena_strndup(arena, slots[i].name, slots[i].name_len);
+          slots[i].action.name = slots[i].name;
+        }
+  }
+
+  array_free(keys);
+  if (!hashed)
+    index_by_name(table);
+  init_hits(table);
+
+  return table;
+}
+
+const struct TagAction *tag_table_lookup(const TagTable *table, const char *name)
+{
+  size_t name_len;
+  unsigned hash2;
+  unsigned hash, seed;
+  const struct Slot *slot;
+
+  if (table->by_name)
+    return dict_get(table->by_name, name);
+  hash = hash_name(name, &name_len, &hash2);
+  seed = table->seeds[bucket_of(hash, table->bucket_count)];
+  slot = &table->slots[scramble(hash, hash2, seed) & table->slot_mask];
+
+  if (slot->name && slot->name_len == name_len && !memcmp(slot->name, name, name_len))
+    return &slot->action;
+  return NULL;
+}
+
+static size_t slot_index(const TagTable *table, const struct TagAction *action)
+{
+  return ((const char *)action - (const char *)&table->slots[0].action) / sizeof(struct Slot);
+}
+
+#ifndef SANITIZE_NO_STATS
+void tag_table_count(const TagTable *table, const struct TagAction *action, struct StatsTally *tally)
+{
+  stats_count_tag(tally, (unsigned long long *)(table->hits + tally->shard * table->hits_stride),
+                  slot_index(table, action));
+}
+#endif
+
+unsigned long long tag_table_hits(const TagTable *table, const char *name)
+{
+  const struct TagAction *action = tag_table_lookup(table, name);
+  unsigned long long total = 0;
+  unsigned shard;
+
+  if (!action || !table->hits)
+    return 0;
+  for (shard = 0; shard < STATS_SHARDS; ++shard)
+    {
+      const unsigned long long *hits = (const unsigned long long *)(table->hits + shard * table->hits_stride);
+      total += __atomic_load_n(&hits[slot_index(table, action)], __ATOMIC_RELAXED);
+    }
+  return total;
+}
+
+void tag_table_intern(TagTable *table, xmlDictPtr names)
+{
+  unsigned i, count = 0;
+
+  for (i = 0; i <= table->slot_mask; ++i)
+    count += table->slots[i].name != NULL;
+
+  table->interned = name_index_new(table->arena, count);
+  for (i = 0; i <= table->slot_mask; ++i)
+    if (table->slots[i].name)
+      name_index_set(table->interned, xmlDictLookup(names, BAD_CAST(table->slots[i].name), -1),
+                     &table->slots[i].action);
+}
+
+const struct TagAction *tag_table_lookup_interned(const TagTable *table, const char *name)
+{
+  const struct TagAction *action;
+
+  if (table->interned && (action = name_index_get(table->interned, name)))
+    return action;
+  return tag_table_lookup(table, name);
+}
+
+/* image: the seeds are used in place, the slots rebuilt around the names in the image */
+
+struct SlotImage
+{
+  image_offset name;
+  uint32_t name_len;
+  uint32_t kind;
+  image_offset sanitizer;
+  image_offset rename_to;
+};
+
+struct TagTableImage
+{
+  uint32_t bucket_count;
+  uint32_t slot_mask;
+  uint32_t by_name;             /* the seeds are not used */
+  image_offset seeds;
+  image_offset slots;
+};
+
+image_offset tag_table_save(const TagTable *table, ImageWriter *w)
+{
+  struct TagTableImage *image;
+  image_offset offset, seeds, slots;
+  unsigned i;
+
+  seeds = image_write(w, table->seeds, table->bucket_count * sizeof(unsigned));
+  slots = image_reserve(w, (table->slot_mask + 1) * sizeof(struct SlotImage));
+  for (i = 0; i <= table->slot_mask; ++i)
+    {
+      const struct Slot *slot = &table->slots[i];
+      image_offset name, sanitizer = 0, rename_to;
+      struct SlotImage *slot_image;
+
+      if (!slot->name)
+        continue;
+      name = image_write_string(w, slot->name);
+      if (slot->action.sanitizer)
+        sanitizer = element_sanitizer_save(slot->action.sanitizer, w);
+      rename_to = image_write_string(w, slot->action.rename_to);
+
+      slot_image = (struct SlotImage *)image_record(w, slots) + i;
+      slot_image->name = name;
+      slot_image->name_len = slot->name_len;
+      slot_image->kind = slot->action.kind;
+      slot_image->sanitizer = sanitizer;
+      slot_image->rename_to = rename_to;
+    }
+
+  offset = image_reserve(w, sizeof(struct TagTableImage));
+  image = image_record(w, offset);
+  image->bucket_count = table->bucket_count;
+  image->slot_mask = table->slot_mask;
+  image->by_name = table->by_name != NULL;
+  image->seeds = seeds;
+  image->slots = slots;
+  return offset;
+}
+
+TagTable *tag_table_load(Arena *arena, CheckerPool *pool, ImageReader *r, image_offset offset)
+{
+  const struct TagTableImage *image = image_at(r, offset, sizeof(struct TagTableImage), 1);
+  const struct SlotImage *slots;
+  TagTable *table;
+  unsigned i;
+
+  if (!image || !image->bucket_count || image->slot_mask & (image->slot_mask + 1))
+    return NULL;
+  slots = image_at(r, image->slots, sizeof(struct SlotImage), (size_t)image->slot_mask + 1);
+  if (!slots)
+    return NULL;
+
+  table = arena_alloc(arena, sizeof(struct TagTable));
+  table->arena = arena;
+  table->bucket_count = image->bucket_count;
+  table->seeds = (unsigned *)image_at(r, image->seeds, sizeof(unsigned), image->bucket_count);
+  table->slot_mask = image->slot_mask;
+  table->slots = arena_calloc(arena, (size_t)image->slot_mask + 1, sizeof(struct Slot));
+  table->interned = NULL;
+  table->by_name = NULL;
+  if (!table->seeds || !table->slots)
+    return NULL;
+  init_hits(table);
+
+  for (i = 0; i <= table->slot_mask; ++i)
+    {
+      struct Slot *slot = &table->slots[i];
+      const char *rename_to;
+
+      if (!slots[i].name)
+        continue;
+      slot->name = (char *)image_string(r, slots[i].name);
+      if (!slot->name || strlen(slot->name) != slots[i].name_len)
+        return NULL;
+      slot->name_len = slots[i].name_len;
+      slot->action.name = slot->name;
+      slot->action.kind = slots[i].kind;
+
+      switch (slot->action.kind)
+        {
+        case TAG_ALLOW:
+          slot->action.sanitizer = element_sanitizer_load(arena, pool, r, slots[i].sanitizer);
+          if (!slot->action.sanitizer)
+            return NULL;
+          break;
+        case TAG_DELETE:
+          break;
+        case TAG_RENAME:
+          /* rename targets are compared by address */
+          rename_to = image_string(r, slots[i].rename_to);
+          if (!rename_to)
+            return NULL;
+          slot->action.rename_to = quark(rename_to);
+          break;
+        default:
+          return NULL;
+        }
+    }
+
+  if (image->by_name)
+    index_by_name(table);
+  return table;
+}
@@ -0,0 +1,63 @@
+#ifndef SANITIZE_TAG_TABLE_H_INCLUDED
+#define SANITIZE_TAG_TABLE_H_INCLUDED
+
+#include <stddef.h>
+#include <libxml/xmlstring.h>
+#include <libxml/dict.h>
+#include "arena.h"
+#include "dict.h"
+#include "element_sanitizer.h"
+#include "image.h"
+#include "stats.h"
+
+/*
+ * Frozen dispatch table: tag name --> action. Built once from the
+ * mode dictionaries, looked up with a single perfect-hash probe. The
+ * table lives in the mode's arena.
+ *
+ * Once the names are interned in the dictionary the parser's own
+ * dictionary falls back to, a name the parser hands out is found by its
+ * address alone, without hashing or comparing it.
+ */
+
+typedef struct TagTable TagTable;
+
+enum tag_action_kind
+{
+  TAG_REMOVE = 0,               /* unknown tag: drop it, keep children */
+  TAG_ALLOW,
+  TAG_DELETE,
+  TAG_RENAME
+};
+
+/* a longer chain of renames is taken for a cycle, and the element stripped */
+#define TAG_MAX_RENAMES (16)
+
+struct TagAction
+{
+  const char *name;             /* the tag name itself, owned by the table */
+  enum tag_action_kind kind;
+  ElementSanitizer *sanitizer;  /* TAG_ALLOW */
+  const char *rename_to;        /* TAG_RENAME, quark */
+};
+
+TagTable *tag_table_build(Arena *arena, Dict *elements, Dict *delete_elements, Dict *rename_elements);
+const struct TagAction *tag_table_lookup(const TagTable *table, const char *name);
+
+void tag_table_intern(TagTable *table, xmlDictPtr names);
+/* by address first; names interned elsewhere take the hashed path */
+const struct TagAction *tag_table_lookup_interned(const TagTable *table, const char *name);
+
+/* how often the action for a tag was taken; counted in the tally, added up by stats_flush() */
+#ifdef SANITIZE_NO_STATS
+static inline void tag_table_count(const TagTable *table, const struct TagAction *action, struct StatsTally *tally) {}
+#else
+void tag_table_count(const TagTable *table, const struct TagAction *action, struct StatsTally *tally);
+#endif
+unsigned long long tag_table_hits(const TagTable *table, const char *name);
+
+/* NULL for a malformed image; the loaded table reads its seeds and names from the image */
+image_offset tag_table_save(const TagTable *table, ImageWriter *w);
+TagTable *tag_table_load(Arena *arena, CheckerPool *pool, ImageReader *r, image_offset offset);
+
+#endif
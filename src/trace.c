@@ -0,0 +1,57 @@
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+static const char *const phase_names[SANITIZE_PHASE_COUNT] = {
+  "parse",
+  "move",
+  "clean",
+  "serialize",
+  "free"
+};
+
+const char *sanitize_phase_name(enum sanitize_phase phase)
+{
+  return phase < SANITIZE_PHASE_COUNT ? phase_names[phase] : NULL;
+}
+
+static unsigned long long now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+Trace *trace_begin(const Tracer *tracer, Trace *trace, size_t input_bytes, int streamed)
+{
+  if (!tracer->trace)
+    return NULL;
+  memset(trace, 0, sizeof(Trace));
+  trace->report.streamed = streamed;
+  trace->report.input_bytes = input_bytes;
+  trace->start = trace->mark = now();
+  return trace;
+}
+
+void trace_phase(Trace *trace, enum sanitize_phase phase)
+{
+  unsigned long long t;
+
+  if (!trace)
+    return;
+  t = now();
+  trace->report.phase_ns[phase] += t - trace->mark;
+  trace->mark = t;
+}
+
+void trace_end(const Tracer *tracer, Trace *trace, size_t output_bytes, int result)
+{
+  if (!trace)
+    return;
+  trace->report.total_ns = now() - trace->start;
+  trace->report.output_bytes = output_bytes;
+  trace->report.result = result < 0 ? result : 0;
+  tracer->trace(tracer->context, &trace->report);
+}
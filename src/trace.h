@@ -0,0 +1,55 @@
+#ifndef SANITIZE_TRACE_H_INCLUDED
+#define SANITIZE_TRACE_H_INCLUDED
+
+#include <stddef.h>
+
+/* where the time of a call went, on the monotonic clock */
+
+enum sanitize_phase
+{
+  SANITIZE_PHASE_PARSE,         /* the fragment into a document */
+  SANITIZE_PHASE_MOVE,          /* its nodes out of the wrapper into a fragment */
+  SANITIZE_PHASE_CLEAN,
+  SANITIZE_PHASE_SERIALIZE,
+  SANITIZE_PHASE_FREE,          /* the document */
+  SANITIZE_PHASE_COUNT
+};
+
+const char *sanitize_phase_name(enum sanitize_phase phase);
+
+struct sanitize_trace
+{
+  int streamed;                 /* the phases interleave: only total_ns is set */
+  int result;                   /* 0, or what a failed call returned */
+  size_t input_bytes;
+  size_t output_bytes;
+  unsigned long long total_ns;
+  unsigned long long phase_ns[SANITIZE_PHASE_COUNT];  /* all zero for input without markup */
+};
+
+/* called on the calling thread as the call returns */
+typedef void (*sanitize_trace_function)(void *context, const struct sanitize_trace *trace);
+
+typedef struct Tracer Tracer;
+
+struct Tracer
+{
+  sanitize_trace_function trace;
+  void *context;
+};
+
+typedef struct Trace Trace;
+
+struct Trace
+{
+  struct sanitize_trace report;
+  unsigned long long start, mark;
+};
+
+/* NULL when tracer has no function: untraced calls never read the clock */
+Trace *trace_begin(const Tracer *tracer, Trace *trace, size_t input_bytes, int streamed);
+/* the time since the previous phase, or since trace_begin(), goes to phase */
+void trace_phase(Trace *trace, enum sanitize_phase phase);
+void trace_end(const Tracer *tracer, Trace *trace, size_t output_bytes, int result);
+
+#endif
@@ -1,74 +1,147 @@
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 #include <regex.h>
 
 #include "value_checker.h"
 #include "array.h"
+#include "dict.h"
+#include "matcher.h"
+#include "scanner.h"
+#include "arena.h"
+#include "image.h"
 
 struct Check
 {
-#ifndef NDEBUG
   char *re;
-#endif
+  Scanner *scanner;             /* native matcher for common shapes */
   regex_t preg;
+  int compiled;                 /* preg is only built when the matcher cannot take the pattern */
   int inverted;
 };
 
-static void free_check(struct Check *ch)
+struct ValueChecker
 {
-#ifndef NDEBUG
-  free(ch->re);
-#endif
-  regfree(&ch->preg);
-  free(ch);
-}
-
-/* ValueChecker is an alias to Array */
+  struct Check **checks;
+  size_t check_count;
+  Matcher *matcher;             /* all checks without a scanner as one automaton */
+  unsigned positive;            /* matcher bits of plain checks */
+  unsigned inverted;            /* matcher bits of .not checks */
+};
 
-ValueChecker *value_checker_new(void)
+struct CheckerPool
 {
-  return (ValueChecker *)array_new((free_function_t)free_check);
-}
+  Arena *arena;                 /* the mode's: everything below lives there */
+  Dict *checks;                 /* check_key() --> Check */
+  Dict *checkers;               /* "count;" followed by the check keys --> ValueChecker */
+  Array *compiled;              /* Checks holding a regcomp()ed preg, which regfree() has to release */
+};
 
-void value_checker_free(ValueChecker *vc)
+static struct Check *check_new(CheckerPool *pool, const char *re, int inverted)
 {
-  array_free((Array *)vc);
+  struct Check *ch = arena_alloc(pool->arena, sizeof(struct Check));
+  ch->re = arena_strdup(pool->arena, re);
+  ch->scanner = scanner_compile(re);
+  if (ch->scanner)
+    ch->scanner = scanner_freeze(ch->scanner, pool->arena);
+  ch->compiled = 0;
+  ch->inverted = inverted;
+  return ch;
 }
 
-void value_checker_add_regex(ValueChecker *vc, const char *re, int inverted)
+static void value_checker_compile(CheckerPool *pool, ValueChecker *vc)
 {
-  if (re && *re)
+  const char **patterns;
+  size_t i, count = 0;
+
+  vc->matcher = NULL;
+  vc->positive = 0;
+  vc->inverted = 0;
+
+  patterns = malloc((vc->check_count + 1) * sizeof(char *));
+  for (i = 0; i < vc->check_count; ++i)
+    if (!vc->checks[i]->scanner)
+      patterns[count++] = vc->checks[i]->re;
+  if (count && count <= MATCHER_MAX_PATTERNS)
+    vc->matcher = matcher_compile(patterns, count);
+  free(patterns);
+
+  if (vc->matcher)
     {
-      struct Check *ch = malloc(sizeof(struct Check));
-#ifndef NDEBUG
-      ch->re = strdup(re);
-#endif
-      regcomp(&ch->preg, re, REG_EXTENDED | REG_ICASE | REG_NOSUB);
-      ch->inverted = inverted;
-      array_append((Array *)vc, ch);
+      vc->matcher = matcher_freeze(vc->matcher, pool->arena);
+      for (i = 0, count = 0; i < vc->check_count; ++i)
+        {
+          struct Check *check = vc->checks[i];
+          if (check->scanner)
+            continue;
+          if (check->inverted)
+            vc->inverted |= 1u << count;
+          else
+            vc->positive |= 1u << count;
+          ++count;
+        }
     }
-  else
+
+  if (count && !vc->matcher)
     {
-      array_clean((Array *)vc);
+      /* fall back to regexec(); a pattern regcomp() refuses lets no value through, .not or not */
+      for (i = 0; i < vc->check_count; ++i)
+        {
+          struct Check *check = vc->checks[i];
+          if (!check->scanner && !check->compiled)
+            {
+              if (regcomp(&check->preg, check->re, REG_EXTENDED | REG_ICASE | REG_NOSUB))
+                continue;
+              check->compiled = 1;
+              if (!pool->compiled)
+                pool->compiled = array_new(NULL);
+              array_append(pool->compiled, check);
+            }
+        }
     }
 }
 
-int value_checker_check(ValueChecker *vc, const char *value)
+int value_checker_check(ValueChecker *vc, const char *value, struct StatsTally *tally)
 {
   size_t i, size;
 
   if (!vc)
     return 0;
+  if (!value)
+    value = "";                 /* attribute without a value */
 
-  size = ((Array *)vc)->size;
+  size = vc->check_count;
   if (!size)
     return 1;
 
   for (i = 0; i < size; ++i)
     {
-      struct Check *check = ((Array *)vc)->items[i];
+      struct Check *check = vc->checks[i];
+
+      if (!check->scanner)
+        continue;
+      STATS_COUNT(tally, SANITIZE_SCANNER_RUNS);
+      if (scanner_match(check->scanner, value) != check->inverted)
+        return 1;
+    }
+
+  if (vc->matcher)
+    {
+      const unsigned matched = matcher_run(vc->matcher, value, vc->positive);
+
+      STATS_COUNT(tally, SANITIZE_MATCHER_RUNS);
+      return (matched & vc->positive) || (~matched & vc->inverted);
+    }
+
+  for (i = 0; i < size; ++i)
+    {
+      struct Check *check = vc->checks[i];
+
+      if (!check->compiled)
+        continue;
 
       int r = !regexec(&check->preg, value, 0, NULL, 0);
+      STATS_COUNT(tally, SANITIZE_REGEXEC_CALLS);
       if (check->inverted)
 	r = !r;
       if (r)
@@ -78,3 +151,210 @@ int value_checker_check(ValueChecker *vc, const char *value)
   return 0;
 }
 
+/* pool */
+
+CheckerPool *checker_pool_new(Arena *arena)
+{
+  CheckerPool *pool = arena_alloc(arena, sizeof(struct CheckerPool));
+  pool->arena = arena;
+  pool->checks = dict_new_in(arena);
+  pool->checkers = dict_new_in(arena);
+  pool->compiled = NULL;
+  return pool;
+}
+
+void checker_pool_free(CheckerPool *pool)
+{
+  size_t i;
+
+  if (!pool || !pool->compiled)
+    return;
+  for (i = 0; i < pool->compiled->size; ++i)
+    regfree(&((struct Check *)pool->compiled->items[i])->preg);
+  array_free(pool->compiled);
+  pool->compiled = NULL;
+}
+
+/* keys are length-prefixed, so that several of them in a row cannot be read two ways */
+
+static char *check_key(const char *re, int inverted)
+{
+  char *key = malloc(strlen(re) + 24);
+  sprintf(key, "%zu%c%s", strlen(re), inverted ? '!' : '=', re);
+  return key;
+}
+
+ValueChecker *checker_pool_get(CheckerPool *pool, const char *const *res, const int *inverted, size_t count)
+{
+  ValueChecker *vc;
+  char *signature;
+  size_t i, length = 1;
+
+  for (i = 0; i < count; ++i)
+    length += strlen(res[i]) + 24;
+  signature = malloc(length + 24);
+  length = sprintf(signature, "%zu;", count);
+  for (i = 0; i < count; ++i)
+    length += sprintf(signature + length, "%zu%c%s", strlen(res[i]), inverted[i] ? '!' : '=', res[i]);
+
+  vc = dict_get(pool->checkers, signature);
+  if (!vc)
+    {
+      vc = arena_alloc(pool->arena, sizeof(struct ValueChecker));
+      vc->checks = arena_alloc(pool->arena, (count + 1) * sizeof(struct Check *));
+      vc->check_count = count;
+      for (i = 0; i < count; ++i)
+        {
+          char *key = check_key(res[i], inverted[i]);
+          struct Check *ch = dict_get(pool->checks, key);
+
+          if (!ch)
+            {
+              ch = check_new(pool, res[i], inverted[i]);
+              dict_replace(pool->checks, key, ch);
+            }
+          vc->checks[i] = ch;
+          free(key);
+        }
+      value_checker_compile(pool, vc);
+      dict_replace(pool->checkers, signature, vc);
+    }
+
+  free(signature);
+  return vc;
+}
+
+/* image */
+
+struct CheckImage
+{
+  image_offset re;
+  image_offset scanner;
+  int32_t inverted;
+  uint32_t compiled;            /* left to regcomp(), which runs again on load */
+};
+
+struct ValueCheckerImage
+{
+  uint32_t check_count;
+  image_offset checks;          /* CheckImage offsets */
+  image_offset matcher;
+  uint32_t positive;
+  uint32_t inverted;
+};
+
+static image_offset check_save(const struct Check *check, ImageWriter *w)
+{
+  struct CheckImage *image;
+  image_offset offset, re, scanner = 0;
+
+  if ((offset = image_written(w, check)))
+    return offset;
+
+  re = image_write_string(w, check->re);
+  if (check->scanner)
+    scanner = scanner_save(check->scanner, w);
+
+  offset = image_reserve(w, sizeof(struct CheckImage));
+  image = image_record(w, offset);
+  image->re = re;
+  image->scanner = scanner;
+  image->inverted = check->inverted;
+  image->compiled = check->compiled;
+  image_set_written(w, check, offset);
+  return offset;
+}
+
+image_offset value_checker_save(const ValueChecker *vc, ImageWriter *w)
+{
+  struct ValueCheckerImage *image;
+  image_offset offset, checks, matcher = 0;
+  size_t i;
+
+  if ((offset = image_written(w, vc)))
+    return offset;
+
+  checks = image_reserve(w, vc->check_count * sizeof(image_offset));
+  for (i = 0; i < vc->check_count; ++i)
+    {
+      image_offset check = check_save(vc->checks[i], w);
+      ((image_offset *)image_record(w, checks))[i] = check;
+    }
+  if (vc->matcher)
+    matcher = matcher_save(vc->matcher, w);
+
+  offset = image_reserve(w, sizeof(struct ValueCheckerImage));
+  image = image_record(w, offset);
+  image->check_count = vc->check_count;
+  image->checks = checks;
+  image->matcher = matcher;
+  image->positive = vc->positive;
+  image->inverted = vc->inverted;
+  image_set_written(w, vc, offset);
+  return offset;
+}
+
+static struct Check *check_load(CheckerPool *pool, ImageReader *r, image_offset offset)
+{
+  const struct CheckImage *image = image_at(r, offset, sizeof(struct CheckImage), 1);
+  struct Check *ch;
+
+  if (!image)
+    return NULL;
+  if ((ch = image_loaded(r, offset)))
+    return ch;
+
+  ch = arena_alloc(pool->arena, sizeof(struct Check));
+  ch->re = (char *)image_string(r, image->re);
+  ch->scanner = NULL;
+  ch->compiled = 0;
+  ch->inverted = image->inverted != 0;
+  if (!ch->re)
+    return NULL;
+  if (image->scanner && !(ch->scanner = scanner_load(pool->arena, r, image->scanner)))
+    return NULL;
+  if (image->compiled)
+    {
+      if (regcomp(&ch->preg, ch->re, REG_EXTENDED | REG_ICASE | REG_NOSUB))
+        return NULL;
+      ch->compiled = 1;
+      if (!pool->compiled)
+        pool->compiled = array_new(NULL);
+      array_append(pool->compiled, ch);
+    }
+
+  image_set_loaded(r, offset, ch);
+  return ch;
+}
+
+ValueChecker *checker_pool_load(CheckerPool *pool, ImageReader *r, image_offset offset)
+{
+  const struct ValueCheckerImage *image = image_at(r, offset, sizeof(struct ValueCheckerImage), 1);
+  const image_offset *checks;
+  ValueChecker *vc;
+  size_t i;
+
+  if (!image)
+    return NULL;
+  if ((vc = image_loaded(r, offset)))
+    return vc;
+
+  checks = image_at(r, image->checks, sizeof(image_offset), image->check_count);
+  if (!checks)
+    return NULL;
+
+  vc = arena_alloc(pool->arena, sizeof(struct ValueChecker));
+  vc->checks = arena_alloc(pool->arena, (image->check_count + 1) * sizeof(struct Check *));
+  vc->check_count = image->check_count;
+  vc->matcher = NULL;
+  vc->positive = image->positive;
+  vc->inverted = image->inverted;
+  for (i = 0; i < vc->check_count; ++i)
+    if (!(vc->checks[i] = check_load(pool, r, checks[i])))
+      return NULL;
+  if (image->matcher && !(vc->matcher = matcher_load(pool->arena, r, image->matcher)))
+    return NULL;
+
+  image_set_loaded(r, offset, vc);
+  return vc;
+}
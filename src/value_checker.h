@@ -1,12 +1,31 @@
 #ifndef SANITIZE_VALUE_CHECKER_H_INCLUDED
 #define SANITIZE_VALUE_CHECKER_H_INCLUDED
 
+#include "arena.h"
+#include "image.h"
+#include "stats.h"
+
 typedef struct ValueChecker ValueChecker;
 
-ValueChecker *value_checker_new(void);
-void value_checker_free(ValueChecker *vc);
-void value_checker_add_regex(ValueChecker *vc, const char *re, int inverted);
-int value_checker_check(ValueChecker *vc, const char *value);
+/* scanner, matcher and regexec() runs are counted in tally */
+int value_checker_check(ValueChecker *vc, const char *value, struct StatsTally *tally);
+
+/*
+ * Compiled checkers shared across a mode: identical check lists get one
+ * ValueChecker and identical (pattern, inverted) pairs one compiled check.
+ * All of it lives in the mode's arena; checker_pool_free() only releases
+ * what regcomp() allocated for patterns the matcher could not take.
+ */
+
+typedef struct CheckerPool CheckerPool;
+
+CheckerPool *checker_pool_new(Arena *arena);
+void checker_pool_free(CheckerPool *pool);
+ValueChecker *checker_pool_get(CheckerPool *pool, const char *const *res, const int *inverted, size_t count);
+
+/* checkers shared in the image are shared once loaded; NULL for a malformed image */
+image_offset value_checker_save(const ValueChecker *vc, ImageWriter *w);
+ValueChecker *checker_pool_load(CheckerPool *pool, ImageReader *r, image_offset offset);
 
 #endif
 
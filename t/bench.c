@@ -0,0 +1,763 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <libxml/parser.h>
+
+#include <sanitize.h>
+
+/* allocation accounting: every malloc in the process goes through here; per thread, so that counting does not serialize the threaded runs */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static __thread size_t allocations = 0;
+static __thread size_t allocated_bytes = 0;
+
+void *malloc(size_t size)
+{
+  ++allocations;
+  allocated_bytes += size;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+  ++allocations;
+  allocated_bytes += count * size;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  ++allocations;
+  allocated_bytes += size;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+  __libc_free(ptr);
+}
+
+/* corpus */
+
+struct corpus
+{
+  const char *name;
+  char **docs;
+  size_t count;
+  size_t bytes;
+};
+
+static const char *fragments[] = {
+  "Lorem ipsum dolor sit amet, consectetur adipiscing elit. ",
+  "<b>Sed</b> do <i>eiusmod</i> tempor incididunt ut labore. ",
+  "<a href=\"http://example.com/page?id=42&amp;x=1\" title=\"example\">link</a> ",
+  "<a href=\"javascript:alert('xss')\">bad link</a> ",
+  "<p>Ut enim ad minim veniam, <strong>quis nostrud</strong> exercitation.</p>",
+  "<blockquote cite=\"https://example.org/\">Duis aute irure dolor</blockquote>",
+  "<ul><li>one</li><li>two</li><li><em>three</em></li></ul>",
+  "<img src=\"https://example.com/logo.png\" alt=\"logo\" width=\"100\" height=\"20\">",
+  "<script>alert(\"hello world\");</script>",
+  "<div class=\"post\" style=\"color: red\" onclick=\"steal()\">styled</div>",
+  "<!-- a comment -->",
+  "caf&eacute; &amp; cr&egrave;me &lt;br&gt; 5 &gt; 3 ",
+  "<table><tr><td colspan=\"2\">cell</td><td>cell</td></tr></table>",
+  "<h2>Heading</h2><hr>",
+  "plain text without any markup at all, just words and punctuation. ",
+};
+
+/* usernames, titles, short replies: no markup at all */
+static const char *plain_fragments[] = {
+  "Re: meeting notes for Tuesday ",
+  "caf\xc3\xa9 cr\xc3\xa8" "me br\xc3\xbb" "l\xc3\xa9" "e ",
+  "5 > 3, and that is fine. ",
+  "thanks, see you tomorrow! ",
+  "user_name-42 ",
+};
+
+/* pasted from a word processor: every element carries styling attributes */
+static const char *pasted_fragments[] = {
+  "<p class=\"MsoNormal\" style=\"margin:0cm;line-height:115%;font-size:11pt\" dir=\"ltr\" id=\"docs-internal-guid-1\">",
+  "<span style=\"font-family:Arial;color:#000000;background-color:transparent;font-weight:400\" lang=\"EN-US\" data-mce-style=\"x\">Lorem ipsum dolor</span>",
+  "<b style=\"font-weight:normal\" id=\"docs-internal-guid-2\" class=\"c1\">sit amet</b>, ",
+  "<a href=\"https://example.com/?utm_source=x\" target=\"_blank\" rel=\"noopener\" style=\"color:#1155cc\" class=\"c4\" title=\"link\">link</a> ",
+  "<td width=\"120\" valign=\"top\" style=\"border:solid windowtext 1.0pt;padding:0cm 5.4pt\" class=\"c2\" colspan=\"1\">cell</td>",
+  "</p>",
+};
+
+#define FRAGMENT_COUNT(fragments) (sizeof(fragments) / sizeof(fragments[0]))
+
+static unsigned corpus_seed = 12345;
+
+static unsigned corpus_random(void)
+{
+  corpus_seed = corpus_seed * 1103515245 + 12345;
+  return (corpus_seed >> 16) & 0x7fff;
+}
+
+static char *generate_document(const char **fragments, size_t fragment_count, size_t target_size)
+{
+  size_t length = 0, allocated = target_size + 256;
+  char *doc = malloc(allocated);
+
+  doc[0] = '\0';
+  while (length < target_size)
+    {
+      const char *fragment = fragments[corpus_random() % fragment_count];
+      size_t fragment_length = strlen(fragment);
+
+      if (length + fragment_length + 1 > allocated)
+        {
+          allocated = (length + fragment_length + 1) * 2;
+          doc = realloc(doc, allocated);
+        }
+      memcpy(doc + length, fragment, fragment_length + 1);
+      length += fragment_length;
+    }
+  return doc;
+}
+
+static void corpus_init(struct corpus *corpus, const char *name, size_t count, size_t doc_size,
+                        const char **fragments, size_t fragment_count)
+{
+  size_t i;
+
+  corpus->name = name;
+  corpus->docs = malloc(count * sizeof(char *));
+  corpus->count = count;
+  corpus->bytes = 0;
+
+  for (i = 0; i < count; ++i)
+    {
+      corpus->docs[i] = generate_document(fragments, fragment_count, doc_size);
+      corpus->bytes += strlen(corpus->docs[i]);
+    }
+}
+
+static void corpus_free(struct corpus *corpus)
+{
+  size_t i;
+
+  for (i = 0; i < corpus->count; ++i)
+    free(corpus->docs[i]);
+  free(corpus->docs);
+}
+
+/* measurement */
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int double_less(const void *a, const void *b)
+{
+  const double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t count, double p)
+{
+  size_t index = (size_t)(p * (count - 1) + 0.5);
+  return sorted[index];
+}
+
+/* engines under test; the result, if any, is freed by the caller */
+
+typedef char *(*engine_function)(const char *html, struct sanitize_mode *mode);
+
+static size_t streamed_bytes = 0;
+
+static int discard(void *context, const char *data, size_t len)
+{
+  streamed_bytes += len;
+  return 0;
+}
+
+static char *run_stream(const char *html, struct sanitize_mode *mode)
+{
+  sanitize_stream(html, mode, discard, NULL);
+  return NULL;
+}
+
+static sanitize_buffer reused_output;
+
+static char *run_into(const char *html, struct sanitize_mode *mode)
+{
+  buffer_clear(&reused_output);
+  sanitize_into(html, mode, &reused_output);
+  return NULL;
+}
+
+static struct sanitize_ctx *reused_ctx;
+static struct sanitize_mode *reused_ctx_mode;
+
+static char *run_ctx(const char *html, struct sanitize_mode *mode)
+{
+  if (reused_ctx_mode != mode)
+    {
+      sanitize_ctx_free(reused_ctx);
+      reused_ctx = sanitize_ctx_new(mode);
+      reused_ctx_mode = mode;
+    }
+  sanitize_ctx_run(reused_ctx, html, strlen(html));
+  return NULL;
+}
+
+static const struct
+{
+  const char *name;
+  engine_function run;
+} engines[] = {
+  { "tree", sanitize },
+  { "into", run_into },
+  { "ctx", run_ctx },
+  { "stream", run_stream }
+};
+
+static void bench(const char *mode_name, struct sanitize_mode *mode, size_t engine, struct corpus *corpus, unsigned rounds)
+{
+  size_t calls = corpus->count * rounds;
+  double *latencies = malloc(calls * sizeof(double));
+  size_t allocations_before, bytes_before, allocations_total, bytes_total;
+  double total = 0, start, elapsed;
+  size_t i, call = 0;
+  unsigned round;
+
+  /* warm up */
+  for (i = 0; i < corpus->count && i < 16; ++i)
+    free(engines[engine].run(corpus->docs[i], mode));
+
+  allocations_before = allocations;
+  bytes_before = allocated_bytes;
+
+  for (round = 0; round < rounds; ++round)
+    for (i = 0; i < corpus->count; ++i)
+      {
+        char *result;
+
+        start = now();
+        result = engines[engine].run(corpus->docs[i], mode);
+        elapsed = now() - start;
+
+        free(result);
+        latencies[call++] = elapsed;
+        total += elapsed;
+      }
+
+  allocations_total = allocations - allocations_before;
+  bytes_total = allocated_bytes - bytes_before;
+
+  qsort(latencies, calls, sizeof(double), double_less);
+
+  printf("%-10s %-6s %-8s %10.0f %8.2f %9.1f %9.1f %9.1f %9.1f %9.1f %10.1f\n",
+         mode_name,
+         engines[engine].name,
+         corpus->name,
+         calls / total,
+         corpus->bytes * (double)rounds / total / (1024 * 1024),
+         percentile(latencies, calls, 0.50) * 1e6,
+         percentile(latencies, calls, 0.90) * 1e6,
+         percentile(latencies, calls, 0.99) * 1e6,
+         latencies[calls - 1] * 1e6,
+         (double)allocations_total / calls,
+         (double)bytes_total / calls / 1024);
+
+  free(latencies);
+}
+
+/* scaling: every thread runs the whole corpus with its own context */
+
+struct worker
+{
+  pthread_t thread;
+  struct sanitize_mode *mode;
+  struct corpus *corpus;
+  unsigned rounds;
+};
+
+static void *worker_run(void *arg)
+{
+  struct worker *worker = arg;
+  struct sanitize_ctx *ctx = sanitize_ctx_new(worker->mode);
+  unsigned round;
+  size_t i;
+
+  for (round = 0; round < worker->rounds; ++round)
+    for (i = 0; i < worker->corpus->count; ++i)
+      sanitize_ctx_run(ctx, worker->corpus->docs[i], strlen(worker->corpus->docs[i]));
+
+  sanitize_ctx_free(ctx);
+  return NULL;
+}
+
+static void bench_threads(const char *mode_name, struct sanitize_mode *mode, struct corpus *corpus, unsigned rounds, unsigned max_threads)
+{
+  struct worker *workers = malloc(max_threads * sizeof(struct worker));
+  double single = 0;
+  unsigned threads, t;
+
+  for (threads = 1; ; threads *= 2)
+    {
+      double start, elapsed, rate;
+
+      if (threads > max_threads)
+        threads = max_threads;
+
+      start = now();
+      for (t = 0; t < threads; ++t)
+        {
+          workers[t].mode = mode;
+          workers[t].corpus = corpus;
+          workers[t].rounds = rounds;
+          pthread_create(&workers[t].thread, NULL, worker_run, &workers[t]);
+        }
+      for (t = 0; t < threads; ++t)
+        pthread_join(workers[t].thread, NULL);
+
+      elapsed = now() - start;
+      rate = corpus->count * (double)rounds * threads / elapsed;
+      if (threads == 1)
+        single = rate;
+
+      printf("%-10s %-8s %7u %10.0f %8.2f %8.2fx\n",
+             mode_name,
+             corpus->name,
+             threads,
+             rate,
+             corpus->bytes * (double)rounds * threads / elapsed / (1024 * 1024),
+             rate / single);
+
+      if (threads == max_threads)
+        break;
+    }
+
+  free(workers);
+}
+
+/* batch: all corpora in one size-skewed batch, the large documents first */
+
+static void bench_batch(const char *mode_name, struct sanitize_mode *mode, struct corpus *corpora, size_t corpus_count, unsigned rounds, unsigned max_threads)
+{
+  const char **inputs;
+  char **outputs;
+  size_t count = 0, bytes = 0, c, i;
+  double single = 0;
+  unsigned threads, round;
+
+  for (c = 0; c < corpus_count; ++c)
+    count += corpora[c].count;
+  inputs = malloc(count * sizeof(char *));
+  outputs = malloc(count * sizeof(char *));
+
+  count = 0;
+  for (c = corpus_count; c-- > 0; )
+    {
+      for (i = 0; i < corpora[c].count; ++i)
+        inputs[count++] = corpora[c].docs[i];
+      bytes += corpora[c].bytes;
+    }
+
+  for (threads = 1; ; threads *= 2)
+    {
+      double start, elapsed;
+
+      if (threads > max_threads)
+        threads = max_threads;
+
+      start = now();
+      for (round = 0; round < rounds; ++round)
+        {
+          sanitize_batch(inputs, NULL, count, mode, outputs, threads);
+          for (i = 0; i < count; ++i)
+            free(outputs[i]);
+        }
+      elapsed = now() - start;
+      if (threads == 1)
+        single = elapsed;
+
+      printf("%-10s %-8s %7u %10.0f %8.2f %8.2fx\n",
+             mode_name,
+             "batch",
+             threads,
+             count * (double)rounds / elapsed,
+             bytes * (double)rounds / elapsed / (1024 * 1024),
+             single / elapsed);
+
+      if (threads == max_threads)
+        break;
+    }
+
+  free(outputs);
+  free(inputs);
+}
+
+/* Dict: the table behind every name lookup while a mode is built */
+
+static void bench_dict(size_t key_count, unsigned rounds)
+{
+  char **keys = malloc(key_count * sizeof(char *));
+  char **misses = malloc(key_count * sizeof(char *));
+  size_t i, found = 0;
+  size_t start_allocations;
+  double start, insert_time, hit_time, miss_time;
+  unsigned round;
+  Dict *dict = NULL;
+
+  for (i = 0; i < key_count; ++i)
+    {
+      char key[32];
+
+      snprintf(key, sizeof(key), "data-attribute-%zu", i * 7919);
+      keys[i] = strdup(key);
+      strcat(key, "-x");        /* shares the whole of a stored key as a prefix */
+      misses[i] = strdup(key);
+    }
+
+  start_allocations = allocations;
+  start = now();
+  for (round = 0; round < rounds; ++round)
+    {
+      dict_free(dict);
+      dict = dict_new(NULL);
+      for (i = 0; i < key_count; ++i)
+        dict_replace(dict, keys[i], keys[i]);
+    }
+  insert_time = now() - start;
+
+  start = now();
+  for (round = 0; round < rounds; ++round)
+    for (i = 0; i < key_count; ++i)
+      found += dict_get(dict, keys[i]) != NULL;
+  hit_time = now() - start;
+
+  start = now();
+  for (round = 0; round < rounds; ++round)
+    for (i = 0; i < key_count; ++i)
+      found += dict_get(dict, misses[i]) != NULL;
+  miss_time = now() - start;
+
+  if (found != key_count * rounds)
+    fprintf(stderr, "Dict lookups found %zu keys instead of %zu.\n", found, key_count * rounds);
+
+  printf("%-8s %7zu %9.1f %9.1f %9.1f %9.2f\n", "dict", key_count,
+         insert_time * 1e9 / (key_count * rounds),
+         hit_time * 1e9 / (key_count * rounds),
+         miss_time * 1e9 / (key_count * rounds),
+         (allocations - start_allocations) / (double)(key_count * rounds));
+
+  dict_free(dict);
+  for (i = 0; i < key_count; ++i)
+    {
+      free(keys[i]);
+      free(misses[i]);
+    }
+  free(misses);
+  free(keys);
+}
+
+/* footprint and lifetime cost of the shipped modes */
+
+static void bench_mode_memory(const char *mode_name, unsigned rounds)
+{
+  char path[64], image_path[64];
+  double load_time = 0, image_time = 0, free_time = 0;
+  size_t usage = 0, start_allocations = 0, mode_allocations = 0;
+  unsigned round;
+
+  snprintf(path, sizeof(path), "modes/%s.xml", mode_name);
+  snprintf(image_path, sizeof(image_path), "/tmp/bench-%s.mode", mode_name);
+  for (round = 0; round < rounds; ++round)
+    {
+      struct sanitize_mode *mode;
+      double start = now();
+
+      start_allocations = allocations;
+      mode = mode_load(path);
+      load_time += now() - start;
+      mode_allocations = allocations - start_allocations;
+      usage = mode_memory_usage(mode);
+
+      if (!round)
+        mode_save_compiled(mode, image_path);
+
+      start = now();
+      mode_free(mode);
+      free_time += now() - start;
+    }
+
+  /* the same mode mapped from its compiled image */
+  for (round = 0; round < rounds; ++round)
+    {
+      struct sanitize_mode *mode;
+      double start = now();
+
+      mode = mode_load_compiled(image_path);
+      image_time += now() - start;
+      mode_free(mode);
+    }
+  unlink(image_path);
+
+  printf("%-10s %9.1f %9.1f %9.1f %9.1f %9zu\n", mode_name, usage / 1024.0,
+         load_time * 1e6 / rounds, image_time * 1e6 / rounds, free_time * 1e6 / rounds, mode_allocations);
+}
+
+/* reload: readers go through a mode handle while it is replaced every millisecond */
+
+struct reader
+{
+  pthread_t thread;
+  struct sanitize_mode_handle *handle;
+  struct corpus *corpus;
+  unsigned rounds;
+  unsigned *finished;
+};
+
+static void *reader_run(void *arg)
+{
+  struct reader *reader = arg;
+  unsigned round;
+  size_t i;
+
+  for (round = 0; round < reader->rounds; ++round)
+    for (i = 0; i < reader->corpus->count; ++i)
+      {
+        struct sanitize_mode *mode = mode_handle_acquire(reader->handle);
+        free(sanitize(reader->corpus->docs[i], mode));
+        mode_handle_release(mode);
+      }
+  __atomic_add_fetch(reader->finished, 1, __ATOMIC_SEQ_CST);
+  return NULL;
+}
+
+static void bench_reload(struct corpus *corpus, unsigned rounds, unsigned threads, int reload)
+{
+  struct sanitize_mode_handle *handle = mode_handle_new(mode_load("modes/relaxed.xml"));
+  struct reader *readers = malloc(threads * sizeof(struct reader));
+  unsigned t, finished = 0, reloads = 0;
+  double start, elapsed;
+
+  start = now();
+  for (t = 0; t < threads; ++t)
+    {
+      readers[t].handle = handle;
+      readers[t].corpus = corpus;
+      readers[t].rounds = rounds;
+      readers[t].finished = &finished;
+      pthread_create(&readers[t].thread, NULL, reader_run, &readers[t]);
+    }
+  while (reload && __atomic_load_n(&finished, __ATOMIC_SEQ_CST) < threads)
+    {
+      mode_handle_replace(handle, mode_load("modes/relaxed.xml"));
+      ++reloads;
+      usleep(1000);
+    }
+  for (t = 0; t < threads; ++t)
+    pthread_join(readers[t].thread, NULL);
+  elapsed = now() - start;
+
+  printf("%-8s %7u %10.0f %9u\n", corpus->name, threads,
+         corpus->count * (double)rounds * threads / elapsed, reloads);
+
+  mode_handle_free(handle);
+  free(readers);
+}
+
+/* phases: where the time of the tree engine goes, as its trace reports it */
+
+static void add_trace(void *context, const struct sanitize_trace *trace)
+{
+  struct sanitize_trace *sum = context;
+  int i;
+
+  for (i = 0; i < SANITIZE_PHASE_COUNT; ++i)
+    sum->phase_ns[i] += trace->phase_ns[i];
+  sum->total_ns += trace->total_ns;
+}
+
+static void bench_phases(struct sanitize_mode *mode, struct corpus *corpus, unsigned rounds)
+{
+  struct sanitize_trace sum;
+  unsigned round;
+  size_t i;
+  int p;
+
+  memset(&sum, 0, sizeof(sum));
+  mode_set_trace(mode, add_trace, &sum);
+  for (round = 0; round < rounds; ++round)
+    for (i = 0; i < corpus->count; ++i)
+      free(sanitize(corpus->docs[i], mode));
+  mode_set_trace(mode, NULL, NULL);
+
+  printf("%-8s", corpus->name);
+  for (p = 0; p < SANITIZE_PHASE_COUNT; ++p)
+    printf(" %9.1f", sum.total_ns ? 100.0 * sum.phase_ns[p] / sum.total_ns : 0.0);
+  printf(" %9.1f\n", sum.total_ns / 1e3 / (corpus->count * (double)rounds));
+}
+
+/* nesting: time per document as the fragment gets deeper */
+
+static void bench_nesting(struct sanitize_mode *mode, size_t depth, unsigned rounds)
+{
+  static const char *levels[] = { "<b>", "<span>", "<strong>" };
+  char *html = malloc(depth * 8 + 2), *p = html;
+  double start, tree, stream;
+  unsigned round;
+  size_t i;
+
+  for (i = 0; i < depth; ++i)
+    p += sprintf(p, "%s", levels[i % 3]);
+  strcpy(p, "x");
+
+  start = now();
+  for (round = 0; round < rounds; ++round)
+    free(sanitize(html, mode));
+  tree = now() - start;
+
+  start = now();
+  for (round = 0; round < rounds; ++round)
+    sanitize_stream(html, mode, discard, NULL);
+  stream = now() - start;
+
+  printf("%-8s %7zu %9.1f %9.1f\n", "nesting", depth, tree * 1e6 / rounds, stream * 1e6 / rounds);
+  free(html);
+}
+
+/* tenants: many distinct modes, each interning rename targets nobody else uses */
+
+static void bench_tenants(size_t tenant_count, size_t window)
+{
+  enum { RENAMES = 20 };
+  size_t t, k;
+  double load_time = 0, free_time = 0;
+
+  for (t = 0; t < tenant_count; ++t)
+    {
+      char xml[RENAMES * 64 + 64];
+      size_t len = 0;
+      struct sanitize_mode *mode;
+      double start;
+
+      len += snprintf(xml + len, sizeof(xml) - len, "<mode><elements><b/></elements>");
+      for (k = 0; k < RENAMES; ++k)
+        len += snprintf(xml + len, sizeof(xml) - len, "<rename to='t%zu-%zu'><x%zu/></rename>", t, k, k);
+      snprintf(xml + len, sizeof(xml) - len, "</mode>");
+
+      start = now();
+      mode = mode_memory(xml);
+      load_time += now() - start;
+
+      start = now();
+      mode_free(mode);
+      free_time += now() - start;
+
+      if ((t + 1) % window == 0)
+        {
+          printf("%-8s %7zu %9.1f %9.1f\n", "tenants", t + 1,
+                 load_time * 1e6 / window, free_time * 1e6 / window);
+          load_time = free_time = 0;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+  static const char *mode_names[] = { "default", "basic", "relaxed", "restricted", "untrusted" };
+  struct corpus corpora[5];
+  unsigned scale = 1, max_threads;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  struct sanitize_mode *mode;
+  size_t m, e, c;
+
+  if (argc > 1)
+    scale = atoi(argv[1]) > 0 ? atoi(argv[1]) : 1;
+  max_threads = cpus > 0 ? cpus : 1;
+  if (argc > 2 && atoi(argv[2]) > 0)
+    max_threads = atoi(argv[2]);
+
+  sanitize_init();
+
+  corpus_init(&corpora[0], "title", 2000, 60, plain_fragments, FRAGMENT_COUNT(plain_fragments));
+  corpus_init(&corpora[1], "comment", 2000, 120, fragments, FRAGMENT_COUNT(fragments));
+  corpus_init(&corpora[2], "post", 200, 4 * 1024, fragments, FRAGMENT_COUNT(fragments));
+  corpus_init(&corpora[3], "pasted", 100, 16 * 1024, pasted_fragments, FRAGMENT_COUNT(pasted_fragments));
+  corpus_init(&corpora[4], "document", 4, 256 * 1024, fragments, FRAGMENT_COUNT(fragments));
+
+  printf("%-10s %-6s %-8s %10s %8s %9s %9s %9s %9s %9s %10s\n",
+         "mode", "engine", "corpus", "docs/s", "MB/s", "p50 us", "p90 us", "p99 us", "max us", "allocs", "KiB alloc");
+
+  for (m = 0; m < sizeof(mode_names) / sizeof(mode_names[0]); ++m)
+    {
+      char path[64];
+
+      snprintf(path, sizeof(path), "modes/%s.xml", mode_names[m]);
+      mode = mode_load(path);
+      if (!mode)
+        {
+          fprintf(stderr, "Cannot load mode '%s'.\n", path);
+          return 1;
+        }
+
+      for (e = 0; e < sizeof(engines) / sizeof(engines[0]); ++e)
+        for (c = 0; c < sizeof(corpora) / sizeof(corpora[0]); ++c)
+          bench(mode_names[m], mode, e, &corpora[c], 5 * scale);
+
+      sanitize_ctx_free(reused_ctx);
+      reused_ctx = NULL;
+      reused_ctx_mode = NULL;
+      mode_free(mode);
+    }
+
+  printf("\n%-10s %-8s %7s %10s %8s %9s\n", "mode", "corpus", "threads", "docs/s", "MB/s", "speedup");
+
+  mode = mode_load("modes/relaxed.xml");
+  for (c = 0; c < sizeof(corpora) / sizeof(corpora[0]); ++c)
+    bench_threads("relaxed", mode, &corpora[c], 5 * scale, max_threads);
+  bench_batch("relaxed", mode, corpora, sizeof(corpora) / sizeof(corpora[0]), 2 * scale, max_threads);
+
+  printf("\n%-8s %9s %9s %9s %9s %9s %9s\n", "phases %", "parse", "move", "clean", "serialize", "free", "total us");
+  for (c = 0; c < sizeof(corpora) / sizeof(corpora[0]); ++c)
+    bench_phases(mode, &corpora[c], 5 * scale);
+  mode_free(mode);
+
+  printf("\n%-8s %7s %9s %9s %9s %9s\n", "table", "keys", "insert ns", "hit ns", "miss ns", "allocs");
+  bench_dict(16, 20000 * scale);
+  bench_dict(256, 2000 * scale);
+  bench_dict(4096, 100 * scale);
+
+  printf("\n%-10s %9s %9s %9s %9s %9s\n", "mode", "KiB", "load us", "image us", "free us", "allocs");
+  for (m = 0; m < sizeof(mode_names) / sizeof(mode_names[0]); ++m)
+    bench_mode_memory(mode_names[m], 200 * scale);
+
+  printf("\n%-8s %7s %10s %9s\n", "reload", "threads", "docs/s", "reloads");
+  bench_reload(&corpora[1], 5 * scale, max_threads, 0);
+  bench_reload(&corpora[1], 5 * scale, max_threads, 1);
+
+  printf("\n%-8s %7s %9s %9s\n", "table", "depth", "tree us", "stream us");
+  mode = mode_load("modes/relaxed.xml");
+  bench_nesting(mode, 16, 2000 * scale);
+  bench_nesting(mode, 256, 200 * scale);
+  bench_nesting(mode, 4096, 20 * scale);
+  bench_nesting(mode, 65536, 2 * scale);
+  mode_free(mode);
+
+  printf("\n%-8s %7s %9s %9s\n", "table", "modes", "load us", "free us");
+  bench_tenants(2000 * scale, 500 * scale);
+
+  for (c = 0; c < sizeof(corpora) / sizeof(corpora[0]); ++c)
+    corpus_free(&corpora[c]);
+
+  buffer_destroy(&reused_output);
+  sanitize_cleanup();
+
+  return 0;
+}
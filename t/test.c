@@ -2,9 +2,16 @@
 #include <string.h>
 #include <stdio.h>
 
+#include <pthread.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <regex.h>
 #include <libxml/parser.h>
 
 #include <sanitize.h>
+#include <value_checker.h>
+#include <scanner.h>
+#include <quarks.h>
 
 static int passed = 0, failed = 0;
 
@@ -25,9 +32,931 @@ static void test(const char *testname, struct sanitize_mode *mode, const char *i
   free(r);
 }
 
+struct output
+{
+  char *data;
+  size_t length;
+  size_t limit;                 /* abort once the output grows beyond it */
+};
+
+static int append_output(void *context, const char *data, size_t len)
+{
+  struct output *out = context;
+
+  if (out->length + len > out->limit)
+    return -1;
+  out->data = realloc(out->data, out->length + len + 1);
+  memcpy(out->data + out->length, data, len);
+  out->length += len;
+  out->data[out->length] = '\0';
+  return 0;
+}
+
+static void test_stream(const char *testname, struct sanitize_mode *mode, const char *input, const char *expected)
+{
+  struct output out = { NULL, 0, (size_t)-1 };
+
+  if (!sanitize_stream(input, mode, append_output, &out) && !strcmp(out.data ? out.data : "", expected))
+    {
+      ++passed;
+    }
+  else
+    {
+      ++failed;
+      printf("Test '%s' failed.\n  Input   : %s\n  Output  : %s\n  Expected: %s\n", testname, input, out.data, expected);
+    }
+  free(out.data);
+}
+
+/* modes are loaded, used and freed on several threads at once */
+
+#define THREAD_COUNT (4)
+
+static const char *thread_mode_xml =
+  "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+  "<mode>"
+  "  <elements><b/><span/></elements>"
+  "  <rename to='span'><strong/><em/></rename>"
+  "  <rename><div/></rename>"
+  "</mode>";
+
+static void *thread_run(void *shared_mode)
+{
+  long mismatches = 0;
+  int i;
+
+  for (i = 0; i < 50; ++i)
+    {
+      struct sanitize_mode *own_mode = mode_memory(thread_mode_xml);
+      char *r1 = sanitize("<strong>a</strong><div>b</div><i>c</i>", own_mode);
+      char *r2 = sanitize("<em>x</em><script>y</script>", shared_mode);
+
+      mismatches += strcmp(r1, "<span>a</span> b c") != 0;
+      mismatches += strcmp(r2, "<span>x</span>y") != 0;
+      free(r1);
+      free(r2);
+      mode_free(own_mode);
+    }
+  return (void *)mismatches;
+}
+
+static void test_threads(void)
+{
+  struct sanitize_mode *shared_mode = mode_memory(thread_mode_xml);
+  pthread_t threads[THREAD_COUNT];
+  long mismatches = 0;
+  void *result;
+  int i;
+
+  for (i = 0; i < THREAD_COUNT; ++i)
+    pthread_create(&threads[i], NULL, thread_run, shared_mode);
+  for (i = 0; i < THREAD_COUNT; ++i)
+    {
+      pthread_join(threads[i], &result);
+      mismatches += (long)result;
+    }
+  mode_free(shared_mode);
+
+  if (!mismatches)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'threads' failed: %ld wrong results.\n", mismatches);
+    }
+}
+
+/* quarks added from several threads at once, the set growing under them */
+
+static void *quark_run(void *arg)
+{
+  const char **seen = arg;
+  long wrong = 0;
+  char name[32];
+  int i;
+
+  for (i = 0; i < 1000; ++i)
+    {
+      const char *q;
+
+      sprintf(name, "quark-%d", i);
+      q = quark(name);
+      wrong += strcmp(q, name) != 0 || quark(name) != q || !is_quark((char *)q) || is_quark(name);
+      seen[i] = q;
+    }
+  return (void *)wrong;
+}
+
+static void test_quarks(void)
+{
+  static const char *seen[THREAD_COUNT][1000];
+  pthread_t threads[THREAD_COUNT];
+  long wrong = 0;
+  void *result;
+  int i, t;
+
+  for (t = 0; t < THREAD_COUNT; ++t)
+    pthread_create(&threads[t], NULL, quark_run, seen[t]);
+  for (t = 0; t < THREAD_COUNT; ++t)
+    {
+      pthread_join(threads[t], &result);
+      wrong += (long)result;
+    }
+  /* one copy of each string, whichever thread added it */
+  for (t = 1; t < THREAD_COUNT; ++t)
+    for (i = 0; i < 1000; ++i)
+      wrong += seen[t][i] != seen[0][i];
+  for (i = 1; i < 1000; ++i)
+    wrong += seen[0][i] == seen[0][i - 1];
+
+  if (!wrong)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'quarks' failed: %ld wrong results.\n", wrong);
+    }
+}
+
+/* counts from all threads add up, whichever shard each one got */
+
+static void *stats_run(void *mode)
+{
+  int i;
+
+  for (i = 0; i < 100; ++i)
+    {
+      struct output out = { NULL, 0, (size_t)-1 };
+
+      free(sanitize("<b>x</b><strong>y</strong>", mode));
+      sanitize_stream("<b>x</b>", mode, append_output, &out);
+      free(out.data);
+    }
+  return NULL;
+}
+
+static void test_stats_threads(void)
+{
+  struct sanitize_mode *mode = mode_memory(thread_mode_xml);
+  pthread_t threads[THREAD_COUNT];
+  struct sanitize_stats stats;
+  unsigned long long expected = 0;
+  int wrong = 0, t;
+
+  for (t = 0; t < THREAD_COUNT; ++t)
+    pthread_create(&threads[t], NULL, stats_run, mode);
+  for (t = 0; t < THREAD_COUNT; ++t)
+    pthread_join(threads[t], NULL);
+  mode_stats_snapshot(mode, &stats);
+
+#ifndef SANITIZE_NO_STATS
+  expected = THREAD_COUNT * 100;
+#endif
+  wrong += stats.counters[SANITIZE_DOCUMENTS] != 2 * expected;
+  wrong += stats.counters[SANITIZE_ELEMENTS_RENAMED] != expected;
+  wrong += mode_stats_tag(mode, "b") != 2 * expected;
+  wrong += mode_stats_tag(mode, "strong") != expected;
+  mode_free(mode);
+
+  if (!wrong)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'stats-threads' failed: %d wrong counters.\n", wrong);
+    }
+}
+
+/* a handle replaced over and over while readers use it */
+
+struct reload
+{
+  struct sanitize_mode_handle *handle;
+  int stop;
+};
+
+static void *reload_reader(void *context)
+{
+  struct reload *reload = context;
+  long mismatches = 0;
+
+  while (!__atomic_load_n(&reload->stop, __ATOMIC_SEQ_CST))
+    {
+      struct sanitize_mode *mode = mode_handle_acquire(reload->handle);
+      char *r = sanitize("<b>x</b><i>y</i>", mode);
+
+      mismatches += strcmp(r, "<b>x</b>y") && strcmp(r, "x<i>y</i>");
+      free(r);
+      mode_handle_release(mode);
+    }
+  return (void *)mismatches;
+}
+
+static void test_reload(void)
+{
+  static const char *versions[] = {
+    "<mode><elements><b/></elements></mode>",
+    "<mode><elements><i/></elements></mode>"
+  };
+  struct reload reload = { mode_handle_new(mode_memory(versions[0])), 0 };
+  pthread_t threads[THREAD_COUNT];
+  struct sanitize_mode *held;
+  long mismatches = 0;
+  void *result;
+  char *r;
+  int i;
+
+  for (i = 0; i < THREAD_COUNT; ++i)
+    pthread_create(&threads[i], NULL, reload_reader, &reload);
+
+  /* a version held across a replace stays usable until released */
+  held = mode_handle_acquire(reload.handle);
+  for (i = 1; i <= 200; ++i)
+    mode_handle_replace(reload.handle, mode_memory(versions[i % 2]));
+  r = sanitize("<b>x</b><i>y</i>", held);
+  mismatches += strcmp(r, "<b>x</b>y") != 0;
+  free(r);
+  mode_handle_release(held);
+
+  __atomic_store_n(&reload.stop, 1, __ATOMIC_SEQ_CST);
+  for (i = 0; i < THREAD_COUNT; ++i)
+    {
+      pthread_join(threads[i], &result);
+      mismatches += (long)result;
+    }
+  mode_handle_free(reload.handle);
+
+  if (!mismatches)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'reload' failed: %ld wrong results.\n", mismatches);
+    }
+}
+
+static void test_stats(void)
+{
+  struct sanitize_mode *mode = mode_memory("<mode>"
+                                           "<elements><b/><a href='^http'/></elements>"
+                                           "<delete><script/></delete>"
+                                           "<rename to='b'><strong/></rename>"
+                                           "</mode>");
+  const char *html = "<b>x</b><strong>y</strong><a href=\"http://h\" title=\"t\">z</a><a href=\"ftp://h\">w</a><script>s</script><u>v</u>";
+  struct output out = { NULL, 0, (size_t)-1 };
+  struct sanitize_stats stats;
+  int wrong = 0;
+
+  free(sanitize(html, mode));
+  sanitize_stream(html, mode, append_output, &out);
+  free(out.data);
+  mode_stats_snapshot(mode, &stats);
+
+#ifndef SANITIZE_NO_STATS
+  /* both engines count alike */
+  wrong += stats.counters[SANITIZE_DOCUMENTS] != 2;
+  wrong += stats.counters[SANITIZE_INPUT_BYTES] != 2 * strlen(html);
+  wrong += stats.counters[SANITIZE_ELEMENTS_KEPT] != 8;
+  wrong += stats.counters[SANITIZE_ELEMENTS_RENAMED] != 2;
+  wrong += stats.counters[SANITIZE_ELEMENTS_DELETED] != 2;
+  wrong += stats.counters[SANITIZE_ELEMENTS_STRIPPED] != 2;
+  wrong += stats.counters[SANITIZE_ATTRIBUTES_DROPPED_BY_NAME] != 2;
+  wrong += stats.counters[SANITIZE_ATTRIBUTES_DROPPED_BY_VALUE] != 2;
+  wrong += mode_stats_tag(mode, "b") != 4;
+  wrong += mode_stats_tag(mode, "strong") != 2;
+  wrong += mode_stats_tag(mode, "u") != 0;
+#else
+  wrong += stats.counters[SANITIZE_DOCUMENTS] != 0;
+#endif
+  mode_free(mode);
+
+  /* more tags than the tally keeps: slots evict each other */
+  {
+    char spec[4096] = "<mode><elements>", doc[8192] = "", name[16];
+    int i, round;
+
+    for (i = 0; i < 100; ++i)
+      sprintf(spec + strlen(spec), "<t%d/>", i);
+    strcat(spec, "</elements></mode>");
+    for (round = 0; round < 2; ++round)
+      for (i = 0; i < 100; ++i)
+        sprintf(doc + strlen(doc), "<t%d>x</t%d>", i, i);
+    mode = mode_memory(spec);
+    out.data = NULL;
+    out.length = 0;
+    free(sanitize(doc, mode));
+    sanitize_stream(doc, mode, append_output, &out);
+    free(out.data);
+    for (i = 0; i < 100; ++i)
+      {
+        sprintf(name, "t%d", i);
+#ifndef SANITIZE_NO_STATS
+        wrong += mode_stats_tag(mode, name) != 4;
+#else
+        wrong += mode_stats_tag(mode, name) != 0;
+#endif
+      }
+    mode_free(mode);
+  }
+
+  if (!wrong)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'stats' failed: %d wrong counters.\n", wrong);
+    }
+}
+
+struct traces
+{
+  struct sanitize_trace last[2];
+  int count;
+};
+
+static void record_trace(void *context, const struct sanitize_trace *trace)
+{
+  struct traces *traces = context;
+
+  if (traces->count < 2)
+    traces->last[traces->count] = *trace;
+  ++traces->count;
+}
+
+static void test_trace(void)
+{
+  struct sanitize_mode *mode = mode_memory("<mode><elements><b/></elements></mode>");
+  const char *html = "<b>x</b><i>y</i>";
+  struct output out = { NULL, 0, (size_t)-1 };
+  struct traces traces = { .count = 0 };
+  unsigned long long sum = 0;
+  int i, wrong = 0;
+  char *r;
+
+  mode_set_trace(mode, record_trace, &traces);
+  r = sanitize(html, mode);
+  sanitize_stream(html, mode, append_output, &out);
+
+  wrong += traces.count != 2;
+  for (i = 0; i < SANITIZE_PHASE_COUNT; ++i)
+    sum += traces.last[0].phase_ns[i];
+  wrong += traces.last[0].streamed || traces.last[0].result;
+  wrong += !traces.last[0].phase_ns[SANITIZE_PHASE_PARSE] || sum > traces.last[0].total_ns;
+  wrong += traces.last[0].input_bytes != strlen(html) || traces.last[0].output_bytes != strlen(r);
+  wrong += !traces.last[1].streamed || traces.last[1].phase_ns[SANITIZE_PHASE_PARSE];
+  wrong += traces.last[1].output_bytes != out.length;
+
+  /* untraced again */
+  mode_set_trace(mode, NULL, NULL);
+  free(sanitize(html, mode));
+  wrong += traces.count != 2;
+
+  free(r);
+  free(out.data);
+  mode_free(mode);
+
+  if (!wrong)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'trace' failed: %d wrong fields.\n", wrong);
+    }
+}
+
+/* what sanitize_into() returns, when sanitize_stream() returns the same */
+static int limit_result(struct sanitize_mode *mode, const char *html)
+{
+  struct output out = { NULL, 0, (size_t)-1 };
+  sanitize_buffer buf;
+  int into, stream;
+
+  buffer_init(&buf);
+  into = sanitize_into(html, mode, &buf);
+  stream = sanitize_stream(html, mode, append_output, &out);
+  buffer_destroy(&buf);
+  free(out.data);
+  return into == stream ? into : 99;
+}
+
+static void test_limits(void)
+{
+  struct sanitize_mode *mode = mode_memory("<mode max-input='4096' max-depth='3' max-nodes='8' max-attributes='2'>"
+                                           "<elements><b/><a title=''/></elements><delete><i/></delete></mode>");
+  const char *path = "t/test-limits.mode";
+  struct sanitize_mode *compiled;
+  struct sanitize_limits limits, loaded;
+  struct sanitize_stats stats;
+  size_t i, deep = 100000;
+  char *html, *r;
+  int wrong = 0;
+
+  wrong += limit_result(mode, "<b><b><b>x</b></b></b>") != 0;
+  wrong += limit_result(mode, "<b><b><b><b>x</b></b></b></b>") != SANITIZE_LIMIT_EXCEEDED;
+  wrong += limit_result(mode, "<a title=1>a</a><a title=2>b</a>") != 0;
+  wrong += limit_result(mode, "<a title=1 x=2>a</a><a title=3>b</a>") != SANITIZE_LIMIT_EXCEEDED;
+  wrong += limit_result(mode, "a<b>b</b>c<b>d</b>e<b>f</b>g") != SANITIZE_LIMIT_EXCEEDED;
+  /* what is deleted is parsed all the same */
+  wrong += limit_result(mode, "<i><b><b><b>x</b></b></b></i>") != SANITIZE_LIMIT_EXCEEDED;
+
+  html = malloc(deep * 3 + 1);
+  memset(html, 'x', 5000);
+  html[5000] = '\0';
+  wrong += limit_result(mode, html) != SANITIZE_LIMIT_EXCEEDED;
+
+  /* stopped long before the nesting could cost anything */
+  mode_get_limits(mode, &limits);
+  limits.max_input = 0;
+  mode_set_limits(mode, &limits);
+  for (i = 0; i < deep; ++i)
+    memcpy(html + 3 * i, "<b>", 3);
+  html[3 * deep] = '\0';
+  wrong += limit_result(mode, html) != SANITIZE_LIMIT_EXCEEDED;
+  free(html);
+
+  mode_stats_snapshot(mode, &stats);
+#ifndef SANITIZE_NO_STATS
+  wrong += stats.counters[SANITIZE_LIMITS_EXCEEDED] != 12;
+#endif
+
+  /* or the input as text */
+  limits.escape = 1;
+  mode_set_limits(mode, &limits);
+  r = sanitize("<b><b><b><b>x</b></b></b></b>", mode);
+  wrong += !r || strcmp(r, "&lt;b&gt;&lt;b&gt;&lt;b&gt;&lt;b&gt;x&lt;/b&gt;&lt;/b&gt;&lt;/b&gt;&lt;/b&gt;");
+  free(r);
+  wrong += limit_result(mode, "<b><b><b><b>x</b></b></b></b>") != 99;
+
+  /* but not when it is too long */
+  limits.max_input = 4096;
+  mode_set_limits(mode, &limits);
+  html = malloc(5001);
+  memset(html, '<', 5000);
+  html[5000] = '\0';
+  r = sanitize(html, mode);
+  wrong += r != NULL;
+  free(r);
+  wrong += limit_result(mode, html) != SANITIZE_LIMIT_EXCEEDED;
+  free(html);
+
+  /* compiled modes keep their limits */
+  mode_save_compiled(mode, path);
+  compiled = mode_load_compiled(path);
+  unlink(path);
+  if (compiled)
+    {
+      mode_get_limits(compiled, &loaded);
+      wrong += loaded.max_input != limits.max_input || loaded.max_depth != limits.max_depth ||
+        loaded.max_nodes != limits.max_nodes || loaded.max_attributes != limits.max_attributes ||
+        loaded.escape != limits.escape;
+      mode_free(compiled);
+    }
+  else
+    ++wrong;
+  mode_free(mode);
+
+  if (!wrong)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'limits' failed: %d wrong results.\n", wrong);
+    }
+}
+
+struct deep
+{
+  struct sanitize_mode *mode;
+  const char *html;
+  const char *expected_start;
+  long wrong;
+};
+
+static void *sanitize_deep(void *arg)
+{
+  struct deep *deep = arg;
+  struct output out = { NULL, 0, (size_t)-1 };
+  char *r = sanitize(deep->html, deep->mode);
+
+  /* the tree builder stops at 256 levels, where the streaming engine goes on */
+  deep->wrong += !r || strncmp(r, deep->expected_start, strlen(deep->expected_start));
+  deep->wrong += sanitize_stream(deep->html, deep->mode, append_output, &out) ||
+    strncmp(out.data, deep->expected_start, strlen(deep->expected_start));
+  free(out.data);
+  free(r);
+  return NULL;
+}
+
+/* nesting far deeper than the stack of the thread could take one frame per level */
+static void test_deep(struct sanitize_mode *mode, const char *open, const char *expected_start)
+{
+  enum { DEPTH = 100000 };
+  size_t len = strlen(open), i;
+  char *html = malloc(DEPTH * len + 2);
+  struct deep deep = { mode, html, expected_start, 0 };
+  pthread_attr_t attr;
+  pthread_t thread;
+
+  for (i = 0; i < DEPTH; ++i)
+    memcpy(html + i * len, open, len);
+  strcpy(html + DEPTH * len, "x");
+
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 256 * 1024);
+  pthread_create(&thread, &attr, sanitize_deep, &deep);
+  pthread_join(thread, NULL);
+  pthread_attr_destroy(&attr);
+  free(html);
+
+  if (!deep.wrong)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'deep %s' failed.\n", open);
+    }
+}
+
+struct writes
+{
+  char *data;
+  size_t length;
+  size_t largest;               /* the longest single write */
+};
+
+static int record_write(void *context, const char *data, size_t len)
+{
+  struct writes *w = context;
+
+  if (len > w->largest)
+    w->largest = len;
+  w->data = realloc(w->data, w->length + len + 1);
+  memcpy(w->data + w->length, data, len);
+  w->length += len;
+  w->data[w->length] = '\0';
+  return 0;
+}
+
+/*
+ * A first child held back for the newline is let go once it is large:
+ * the output keeps flowing, without that one newline.
+ */
+static void test_stream_held(void)
+{
+  enum { COUNT = 200000 };
+  struct sanitize_mode *mode = mode_memory("<mode><elements><div/><b/></elements></mode>");
+  struct writes w = { NULL, 0, 0 };
+  char *html = malloc(COUNT * 8 + 64), *p = html, *r;
+  int wrong = 0;
+  size_t i;
+
+  p += sprintf(p, "<div><div>");
+  for (i = 0; i < COUNT; ++i)
+    p += sprintf(p, "<b>x</b>");
+  strcpy(p, "</div>after</div>");
+
+  r = sanitize(html, mode);
+  wrong += sanitize_stream(html, mode, record_write, &w) != 0;
+  wrong += w.largest > 256 * 1024;
+  wrong += !r || strncmp(r, "<div>\n<div>", 11) || !w.data || strncmp(w.data, "<div><div>", 10);
+  wrong += !r || !w.data || strcmp(r + 6, w.data + 5);
+
+  free(r);
+  free(w.data);
+  free(html);
+  mode_free(mode);
+
+  if (!wrong)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'stream-held' failed: %d wrong results.\n", wrong);
+    }
+}
+
+/* a reused context does not keep every name it was ever given */
+static void test_ctx_names(struct sanitize_mode *mode)
+{
+  struct sanitize_ctx *ctx = sanitize_ctx_new(mode);
+  size_t after_warmup = 0, after;
+  char html[96];
+  int i;
+
+  for (i = 0; i < 20000; ++i)
+    {
+      snprintf(html, sizeof(html), "<x%d a%d=\"1\">t</x%d>", i, i, i);
+      sanitize_ctx_run(ctx, html, strlen(html));
+      if (i == 2000)
+        after_warmup = mallinfo2().uordblks;
+    }
+  after = mallinfo2().uordblks;
+  sanitize_ctx_free(ctx);
+
+  if (after < after_warmup + 512 * 1024)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'context-names' failed: %zu KiB more.\n", (after - after_warmup) / 1024);
+    }
+}
+
+/* input that cleans to nothing gives "" from every entry point */
+static void test_empty(const char *testname, struct sanitize_mode *mode, const char *input)
+{
+  struct output out = { NULL, 0, (size_t)-1 };
+  struct sanitize_ctx *ctx = sanitize_ctx_new(mode);
+  sanitize_buffer buf;
+  char *r = sanitize(input, mode), *batch[1];
+  const char *c = sanitize_ctx_run(ctx, input, strlen(input));
+  int wrong = 0;
+
+  buffer_init(&buf);
+  wrong += !r || *r;
+  wrong += !c || *c;
+  wrong += sanitize_into(input, mode, &buf) || !buf.data || *buf.data;
+  wrong += sanitize_batch(&input, NULL, 1, mode, batch, 1) || !batch[0] || *batch[0];
+  wrong += sanitize_stream(input, mode, append_output, &out) || out.length;
+
+  free(r);
+  free(batch[0]);
+  free(out.data);
+  buffer_destroy(&buf);
+  sanitize_ctx_free(ctx);
+
+  if (!wrong)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test '%s' failed: %d entry points disagree.\n", testname, wrong);
+    }
+}
+
+/* a value is kept exactly when regexec() matches it, over every printable byte */
+static void test_regex_agrees(const char *pattern)
+{
+  char xml[256], html[64];
+  struct sanitize_mode *mode;
+  regex_t preg;
+  int compiled, c, wrong = 0;
+
+  snprintf(xml, sizeof(xml), "<mode><elements><a title='%s'/></elements></mode>", pattern);
+  mode = mode_memory(xml);
+  compiled = !regcomp(&preg, pattern, REG_EXTENDED | REG_ICASE | REG_NOSUB);
+  for (c = 0x20; c < 0x7f; ++c)
+    {
+      const char value[2] = { c, '\0' };
+      char *r;
+
+      snprintf(html, sizeof(html), "<a title=\"&#%d;\">x</a>", c);
+      r = sanitize(html, mode);
+      wrong += !r || (strstr(r, "title=") != NULL) != (compiled && !regexec(&preg, value, 0, NULL, 0));
+      free(r);
+    }
+  if (compiled)
+    regfree(&preg);
+  mode_free(mode);
+
+  if (!wrong)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'regex-agrees %s' failed: %d values.\n", pattern, wrong);
+    }
+}
+
+/* identical check lists share one checker, and only identical ones */
+static void test_checker_pool(void)
+{
+  Arena *arena = arena_new();
+  CheckerPool *pool = checker_pool_new(arena);
+  const char *const one[] = { "^(http:|https:)", "^[^/]+[[:space:]]*:" };
+  const char *const joined[] = { "^(http:|https:)^[^/]+[[:space:]]*:" };
+  const char *const split[] = { "a", "1=b" }, *const resplit[] = { "a1=", "b" };
+  const char *const fallback[] = { "^[[=a=]]b" };
+  const int plain[] = { 0, 1 }, swapped[] = { 1, 0 };
+  ValueChecker *vc;
+  size_t before;
+  int wrong = 0;
+
+  vc = checker_pool_get(pool, one, plain, 2);
+  before = arena_size(arena);
+  wrong += checker_pool_get(pool, one, plain, 2) != vc;
+  wrong += arena_size(arena) != before;
+  wrong += checker_pool_get(pool, one, swapped, 2) == vc;
+  wrong += checker_pool_get(pool, one, plain, 1) == vc;
+  wrong += checker_pool_get(pool, joined, plain, 1) == vc;
+  wrong += checker_pool_get(pool, split, plain, 2) == checker_pool_get(pool, resplit, plain, 2);
+
+  /* a check compiled by regcomp() is compiled and released once */
+  vc = checker_pool_get(pool, fallback, plain, 1);
+  wrong += checker_pool_get(pool, fallback, plain, 1) != vc;
+  checker_pool_free(pool);
+  checker_pool_free(pool);
+  arena_free(arena);
+
+  if (!wrong)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'checker-pool' failed: %d wrong results.\n", wrong);
+    }
+}
+
+/* more patterns than the matcher takes are left to regexec() */
+static void test_many_patterns(void)
+{
+  Arena *arena = arena_new();
+  CheckerPool *pool = checker_pool_new(arena);
+  const char *res[40];
+  char patterns[40][16];
+  int inverted[40] = { 0 };
+  struct StatsTally tally;
+  ValueChecker *vc;
+  int i, wrong = 0;
+
+  for (i = 0; i < 40; ++i)
+    {
+      sprintf(patterns[i], "^x%d+y$", i);
+      res[i] = patterns[i];
+    }
+  inverted[39] = 1;
+  vc = checker_pool_get(pool, res, inverted, 39);
+  stats_tally_init(&tally);
+  wrong += !value_checker_check(vc, "X38888Y", &tally);
+  wrong += !value_checker_check(vc, "x0y", &tally);
+  wrong += value_checker_check(vc, "x39y", &tally);
+
+  vc = checker_pool_get(pool, res, inverted, 40);
+  wrong += !value_checker_check(vc, "z", &tally);
+  wrong += value_checker_check(vc, "x39y", &tally);
+  checker_pool_free(pool);
+  arena_free(arena);
+
+  if (!wrong)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'many-patterns' failed: %d wrong results.\n", wrong);
+    }
+}
+
+/* each shape the scanner takes matches as regexec() does */
+static void test_scanner_agrees(const char *pattern)
+{
+  static const char *const values[] = {
+    "", "http", "http:", "http://host/", "HtTp://host/", "HTTPS:x", " http:", "\thttp:", "\nhttp:",
+    "mailto:a@b", "MailTo:", "ftp:", "ftps:", "https", "javascript:alert(1)", "JavaScript :x", " javascript:x",
+    "java\tscript:x", "vbscript\n:x", "/a:b", "a/b:c", "//host:80/", ":x", " :", "x :", "x\t:", "a#b:c",
+    "../up", "..", "x=1", "a b=c", "#=", "\xc3\xa9:", "http\xc2\xa0:"
+  };
+  Scanner *sc = scanner_compile(pattern);
+  regex_t preg;
+  size_t i;
+  int wrong = 0;
+
+  if (!sc || regcomp(&preg, pattern, REG_EXTENDED | REG_ICASE | REG_NOSUB))
+    {
+      ++failed;
+      printf("Test 'scanner-agrees %s' failed: not taken.\n", pattern);
+      scanner_free(sc);
+      return;
+    }
+  for (i = 0; i < sizeof(values) / sizeof(values[0]); ++i)
+    if (scanner_match(sc, values[i]) != !regexec(&preg, values[i], 0, NULL, 0))
+      {
+        ++wrong;
+        printf("  %s on \"%s\"\n", pattern, values[i]);
+      }
+  regfree(&preg);
+  scanner_free(sc);
+
+  if (!wrong)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'scanner-agrees %s' failed: %d values.\n", pattern, wrong);
+    }
+}
+
+/* a compiled mode gives what the mode it was compiled from gives */
+static void test_compiled_same(const char *testname, struct sanitize_mode *mode, const char **samples, size_t sample_count)
+{
+  const char *path = "t/test-same.mode";
+  struct sanitize_mode *compiled;
+  size_t i;
+  int wrong = 0;
+
+  mode_save_compiled(mode, path);
+  compiled = mode_load_compiled(path);
+  unlink(path);
+  if (!compiled)
+    wrong = 1;
+  for (i = 0; i < sample_count && compiled; ++i)
+    {
+      char *expected = sanitize(samples[i], mode), *r = sanitize(samples[i], compiled);
+
+      wrong += !r || strcmp(r, expected);
+      free(expected);
+      free(r);
+    }
+  mode_free(compiled);
+
+  if (!wrong)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test '%s' failed: %d samples differ.\n", testname, wrong);
+    }
+}
+
+/* an image whose header does not match this build is refused */
+static void test_compiled_header(struct sanitize_mode *mode)
+{
+  static const long offsets[] = { 0, 8, 12 };  /* magic, version, byte order */
+  const char *path = "t/test-header.mode";
+  struct sanitize_mode *loaded;
+  size_t i;
+  int wrong = 0;
+
+  for (i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i)
+    {
+      FILE *file;
+      int c;
+
+      mode_save_compiled(mode, path);
+      file = fopen(path, "r+");
+      fseek(file, offsets[i], SEEK_SET);
+      c = fgetc(file);
+      fseek(file, offsets[i], SEEK_SET);
+      fputc(c + 1, file);
+      fclose(file);
+      loaded = mode_load_compiled(path);
+      wrong += loaded != NULL;
+      mode_free(loaded);
+    }
+  unlink(path);
+
+  if (!wrong)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'compiled-header' failed: %d images taken.\n", wrong);
+    }
+}
+
+static void test_batch(struct sanitize_mode *mode, const char **samples, size_t sample_count)
+{
+  enum { COUNT = 300 };
+  const char *inputs[COUNT];
+  char *outputs[COUNT];
+  char *huge;
+  size_t i, len = strlen(samples[0]), mismatches = 0;
+
+  /* one large input first, so that the others have to steal its range */
+  huge = malloc(len * 500 + 1);
+  for (i = 0; i < 500; ++i)
+    memcpy(huge + i * len, samples[0], len);
+  huge[len * 500] = '\0';
+
+  inputs[0] = huge;
+  for (i = 1; i < COUNT; ++i)
+    inputs[i] = samples[i % sample_count];
+
+  if (sanitize_batch(inputs, NULL, COUNT, mode, outputs, 4))
+    ++mismatches;
+
+  for (i = 0; i < COUNT; ++i)
+    {
+      char *expected = sanitize(inputs[i], mode);
+      mismatches += !outputs[i] || strcmp(outputs[i], expected);
+      free(expected);
+      free(outputs[i]);
+    }
+  free(huge);
+
+  if (!mismatches)
+    ++passed;
+  else
+    {
+      ++failed;
+      printf("Test 'batch' failed: %zu wrong results.\n", mismatches);
+    }
+}
+
 int main(int argc, char *argv[])
 {
-  struct sanitize_mode *default_mode, *basic_mode, *relaxed_mode, *restricted_mode, *untrusted_mode, *in_memory_mode;
+  struct sanitize_mode *default_mode, *basic_mode, *relaxed_mode, *restricted_mode, *untrusted_mode, *in_memory_mode, *regex_mode;
+
+  sanitize_init();
 
   default_mode    = mode_load("modes/default.xml");
   basic_mode      = mode_load("modes/basic.xml");
@@ -358,12 +1287,383 @@ int main(int argc, char *argv[])
   test("delete", in_memory_mode, delete_html,
        "<b>Lo<!-- comment -->rem</b> ipsum <span>dolor</span> sit amet ");
 
+  /* regular expressions */
+
+  regex_mode = mode_memory("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+			   "<mode>"
+			   "  <elements>"
+			   "    <a href='^https?://[a-z0-9.-]+(/[^ ]*)?$' title='^[[:alpha:] ]{1,9}$' name.not='[&lt;&gt;]'/>"
+			   "  </elements>"
+			   "</mode>");
+
+  test("regex-interval", regex_mode,
+       "<a href=\"HTTPS://example.com/x\" title=\"Two words\">a</a><a href=\"ftp://example.com/\" title=\"far too long\">b</a>",
+       "<a href=\"HTTPS://example.com/x\" title=\"Two words\">a</a><a>b</a>");
+
+  test("regex-inverted", regex_mode,
+       "<a name=\"top\">a</a><a name=\"a&lt;b\">b</a><a href=\"http://host/a b\">c</a>",
+       "<a name=\"top\">a</a><a>b</a><a>c</a>");
+
+  {
+    /* equivalence classes are left to regcomp(), whose memory is the one thing outside the mode's arena */
+    struct sanitize_mode *fallback_mode = mode_memory("<mode><elements><a title='^[[=a=]]b'/></elements></mode>");
+
+    test("regex-fallback", fallback_mode, "<a title=\"ab\">x</a><a title=\"cb\">y</a>", "<a title=\"ab\">x</a><a>y</a>");
+    if (mode_memory_usage(fallback_mode) > 0 && mode_memory_usage(fallback_mode) < mode_memory_usage(relaxed_mode))
+      ++passed;
+    else
+      {
+        ++failed;
+        printf("Test 'memory-usage' failed: %zu bytes.\n", mode_memory_usage(fallback_mode));
+      }
+    mode_free(fallback_mode);
+  }
+
+  {
+    /* glibc folds case inside the byte range of a bracket only, and has escapes of its own */
+    static const char *const patterns[] = {
+      "^[2-a]$", "^[+-b]$", "^[^2-a]$", "^[A-F]$", "^[a-f]+$", "^[!-/]$", "^[[-`]$", "^[^x-z]$",
+      "^\\a$", "^\\w$", "^\\n$", "^\\.$", "^[\\a]$", "^[Y-c]$", "(x"
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); ++i)
+      test_regex_agrees(patterns[i]);
+  }
+
+  {
+    /* nor does an inverted one */
+    struct sanitize_mode *invalid_mode = mode_memory("<mode><elements><a title.not='^[Y-c]$' name='^x'/></elements></mode>");
+
+    test("regex-invalid", invalid_mode, "<a title=\"x\" name=\"x\">a</a><a title=\"[\" name=\"y\">b</a>",
+         "<a name=\"x\">a</a><a>b</a>");
+    mode_free(invalid_mode);
+  }
+
+  {
+    static const char *const shapes[] = {
+      "^(ftp:|http:|https:|mailto:)", "^(http:|https:)", "^http:", "^HTTP\\:", "^\\.\\./", "^(|x)",
+      "^[^/]+[[:space:]]*:", "^[^/]+:", "^[^#]+[[:space:]]*:", "^[^:]+[[:space:]]*="
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(shapes) / sizeof(shapes[0]); ++i)
+      test_scanner_agrees(shapes[i]);
+    /* and shapes it does not take are left to the matcher */
+    if (scanner_compile("^http:.") || scanner_compile("^[^a]+:") || scanner_compile("^[^/]*:") ||
+        scanner_compile("http:") || scanner_compile("^[^/]+[[:space:]]*::"))
+      {
+        ++failed;
+        printf("Test 'scanner-shapes' failed.\n");
+      }
+    else
+      ++passed;
+  }
+
+  test("scanner-href", relaxed_mode,
+       "<a href=\"HtTp://h/\">a</a><a href=\" http://h/\">b</a><a href=\"\">c</a><a href=\"x/y:z\">d</a>"
+       "<a href=\"JavaScript :x\">e</a><a href=\" javascript:x\">f</a>",
+       "<a href=\"HtTp://h/\">a</a><a>b</a><a href=\"\">c</a><a href=\"x/y:z\">d</a><a>e</a><a>f</a>");
+
+  /* compiled modes behave as the modes they were compiled from */
+
+  {
+    const char *path = "t/test-compiled.mode";
+    struct sanitize_mode *compiled;
+    FILE *file;
+
+    mode_save_compiled(untrusted_mode, path);
+    compiled = mode_load_compiled(path);
+    test("compiled-untrusted", compiled, basic_html,
+         "<b>Lorem</b> <a href=\"pants\" rel=\"noreferrer noopener\" target=\"_blank\">ipsum</a> <a href=\"http://foo.com/\" rel=\"noreferrer noopener\" target=\"_blank\"><strong>dolor</strong></a> sit amet alert(\"hello world\");");
+    mode_free(compiled);
+
+    mode_save_compiled(in_memory_mode, path);
+    compiled = mode_load_compiled(path);
+    test("compiled-delete", compiled, delete_html,
+         "<b>Lo<!-- comment -->rem</b> ipsum <span>dolor</span> sit amet ");
+    test_stream("compiled-stream", compiled, delete_html,
+                "<b>Lo<!-- comment -->rem</b> ipsum <span>dolor</span> sit amet ");
+    mode_free(compiled);
+
+    mode_save_compiled(regex_mode, path);
+    compiled = mode_load_compiled(path);
+    test("compiled-regex", compiled,
+         "<a href=\"HTTPS://example.com/x\" title=\"Two words\">a</a><a href=\"ftp://example.com/\" title=\"far too long\">b</a><a name=\"a&lt;b\">c</a>",
+         "<a href=\"HTTPS://example.com/x\" title=\"Two words\">a</a><a>b</a><a>c</a>");
+    mode_free(compiled);
+
+    test_compiled_header(regex_mode);
+
+    /* a truncated image is refused */
+    file = fopen(path, "r+");
+    fseek(file, 0, SEEK_END);
+    if (ftruncate(fileno(file), ftell(file) / 2) || mode_load_compiled(path) ||
+        mode_load_compiled("t/no-such.mode"))
+      {
+        ++failed;
+        printf("Test 'compiled-truncated' failed.\n");
+      }
+    else
+      ++passed;
+    fclose(file);
+    unlink(path);
+  }
+
+  /* attributes are checked in place, whatever the shape of their value */
+
+  test("attributes-dropped", regex_mode,
+       "<a x=\"1\" title=\"Two words\" y=\"2\" name=\"top\" z=\"3\">a</a><a title=\"1\" name=\"b\">b</a>",
+       "<a title=\"Two words\" name=\"top\">a</a><a name=\"b\">b</a>");
+
+  test("attributes-values", regex_mode,
+       "<a title name=\"\">a</a><a title=\"Caf&eacute;\" name=\"x&amp;y\">b</a><a title=\"T&#97;b\" name=\"&gt;\">c</a>",
+       "<a name=\"\">a</a><a name=\"x&amp;y\">b</a><a title=\"Tab\">c</a>");
+
+  test("attributes-mandatory", untrusted_mode,
+       "<a target=\"_top\" href=\"http://h/\" rel=\"x\">a</a>",
+       "<a href=\"http://h/\" rel=\"noreferrer noopener\" target=\"_blank\">a</a>");
+
+  {
+    const char *attribute_html = "<p title=\"x\" onclick=\"y\"><a href=\"HtTp://h/\" href2=\"z\" title=\"a&amp;b\">a</a>"
+      "<img src=\"javascript:x\" alt=\"A\"><a href=\" mailto:x\" rel=\"nofollow\" target=\"_self\">b</a></p>";
+    const char *samples[] = { basic_html, malformed_html, delete_html, attribute_html, "plain text" };
+    struct sanitize_mode *modes[] = { default_mode, basic_mode, relaxed_mode, restricted_mode, untrusted_mode,
+                                      in_memory_mode, regex_mode };
+    size_t i;
+
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i)
+      test_compiled_same("compiled-same", modes[i], samples, 5);
+  }
+
+  /* mandatory attributes: up to 64 per element, the same way in both engines */
+
+  {
+    char xml[64 * 16 + 64], *p = xml;
+    struct sanitize_mode *set_mode;
+    struct sanitize_stats stats;
+    struct output out = { NULL, 0, (size_t)-1 };
+    char *r;
+    int i, wrong = 0;
+
+    p += sprintf(p, "<mode><elements><b a0='^x$'");
+    for (i = 0; i < 64; ++i)
+      p += sprintf(p, " a%d.set='v'", i);
+    strcpy(p, "/></elements></mode>");
+    set_mode = mode_memory(xml);
+
+    r = sanitize("<b a0=\"x\">y</b>", set_mode);
+    sanitize_stream("<b a0=\"x\">y</b>", set_mode, append_output, &out);
+    for (i = 0, p = r; (p = strstr(p, "=\"v\"")); ++p)
+      ++i;
+    wrong += i != 64 || strcmp(r, out.data);
+    mode_stats_snapshot(set_mode, &stats);
+#ifndef SANITIZE_NO_STATS
+    wrong += stats.counters[SANITIZE_ATTRIBUTES_SET] != 128;
+#endif
+    free(r);
+    free(out.data);
+    mode_free(set_mode);
+
+    /* one more is refused */
+    strcpy(xml + strlen(xml) - strlen("/></elements></mode>"), " a64.set='v'/></elements></mode>");
+    set_mode = mode_memory(xml);
+    wrong += set_mode != NULL;
+    mode_free(set_mode);
+
+    if (!wrong)
+      ++passed;
+    else
+      {
+        ++failed;
+        printf("Test 'mandatory-attributes' failed.\n");
+      }
+  }
+
+  /* names that hash alike under both hashes still get a table */
+
+  {
+    const char *path = "t/test-collision.mode";
+    struct sanitize_mode *collision_mode = mode_memory("<mode><elements><b/>"
+                                                       "<bAbAbAbAababababbAbAbAabbAabbAabbAabbAbA/>"
+                                                       "</elements><delete>"
+                                                       "<ababbAababbAbAbAabbAababbAbAbAabababbAbA/>"
+                                                       "</delete><rename to='b'><strong/></rename></mode>");
+    struct sanitize_mode *compiled;
+
+    test("tag-collision", collision_mode, "<b>x</b><strong>y</strong><i>z</i>", "<b>x</b><b>y</b>z");
+    mode_save_compiled(collision_mode, path);
+    compiled = mode_load_compiled(path);
+    unlink(path);
+    test("tag-collision-compiled", compiled, "<b>x</b><strong>y</strong><i>z</i>", "<b>x</b><b>y</b>z");
+    mode_free(compiled);
+    mode_free(collision_mode);
+  }
+
+  /* an attribute whose name is a prefix of an allowed one is not allowed */
+
+  {
+    /* "rel" and "relao" once shared a hash bucket */
+    struct sanitize_mode *prefix_mode = mode_memory("<mode><elements><span relao=''/></elements></mode>");
+
+    test("attribute-prefix", prefix_mode, "<span rel=\"x\" relao=\"y\" relaos=\"z\">a</span>", "<span relao=\"y\">a</span>");
+    mode_free(prefix_mode);
+  }
+
+  /* plain text, which does not go through the parser */
+
+  test("plain-text", relaxed_mode, "Re: 5 > 3\tcaf\xc3\xa9", "Re: 5 &gt; 3\tcaf\xc3\xa9");
+
+  test("plain-text-entity", relaxed_mode, "Tom &amp; Jerry > Itchy & Scratchy", "Tom &amp; Jerry &gt; Itchy &amp; Scratchy");
+
+  test("plain-text-invalid-utf8", relaxed_mode, "caf\xc3 x", "caf\xc3 x");
+
+  /* length-delimited input */
+
+  {
+    char *r = sanitize_n("<b>Lorem</b><i>ipsum</i>", 12, basic_mode);
+    if (r && !strcmp(r, "<b>Lorem</b>"))
+      ++passed;
+    else
+      {
+        ++failed;
+        printf("Test 'length-delimited' failed.\n  Output  : %s\n", r);
+      }
+    free(r);
+  }
+
+  /* caller-owned output buffer */
+
+  {
+    sanitize_buffer out;
+    char *first;
+
+    buffer_init(&out);
+    sanitize_into("<b>Lorem</b>", basic_mode, &out);
+    first = out.data;
+    buffer_clear(&out);
+    sanitize_into("<i>ipsum</i><script>x</script>", basic_mode, &out);
+    if (out.data == first && !strcmp(out.data, "<i>ipsum</i>x"))
+      ++passed;
+    else
+      {
+        ++failed;
+        printf("Test 'output-buffer' failed.\n  Output  : %s\n", out.data);
+      }
+    buffer_destroy(&out);
+  }
+
+  /* reusable context */
+
+  {
+    struct sanitize_ctx *ctx = sanitize_ctx_new(basic_mode);
+    const char *r1 = sanitize_ctx_run(ctx, basic_html, strlen(basic_html));
+    int ok = r1 && !strcmp(r1, "<b>Lorem</b> <a href=\"pants\">ipsum</a> <a href=\"http://foo.com/\"><strong>dolor</strong></a> sit<br>amet alert(\"hello world\");");
+    const char *r2 = sanitize_ctx_run(ctx, "<u>x</u><p>", 8);
+    if (ok && r2 && !strcmp(r2, "<u>x</u>"))
+      ++passed;
+    else
+      {
+        ++failed;
+        printf("Test 'context' failed.\n  Output  : %s\n", r2);
+      }
+    sanitize_ctx_free(ctx);
+  }
+
+  {
+    /* names interned before the mode was compiled again only miss the fast lookup */
+    struct sanitize_ctx *ctx = sanitize_ctx_new(basic_mode);
+    const char *r;
+
+    mode_compile(basic_mode);
+    r = sanitize_ctx_run(ctx, "<b title=x>a</b><u>b</u><xx>c</xx>", 35);
+    if (r && !strcmp(r, "<b>a</b><u>b</u>c"))
+      ++passed;
+    else
+      {
+        ++failed;
+        printf("Test 'context-recompiled' failed.\n  Output  : %s\n", r);
+      }
+    sanitize_ctx_free(ctx);
+  }
+
+  /* streaming */
+
+  test_stream("stream-basic", basic_mode, basic_html,
+              "<b>Lorem</b> <a href=\"pants\">ipsum</a> <a href=\"http://foo.com/\"><strong>dolor</strong></a> sit<br>amet alert(\"hello world\");");
+
+  test_stream("stream-delete", in_memory_mode, delete_html,
+              "<b>Lo<!-- comment -->rem</b> ipsum <span>dolor</span> sit amet ");
+
+  test_stream("stream-blocks", relaxed_mode,
+              "<ul><li>a</li><li>b</li></ul><p>c</p><table><tr><td>1<td>2</table>",
+              "<ul>\n<li>a</li>\n<li>b</li>\n</ul><p>c</p><table><tr>\n<td>1</td>\n<td>2</td>\n</tr></table>");
+
+  {
+    struct output out = { NULL, 0, 0 };
+    if (sanitize_stream(basic_html, basic_mode, append_output, &out) == -1)
+      ++passed;
+    else
+      {
+        ++failed;
+        printf("Test 'stream-abort' failed.\n");
+      }
+    free(out.data);
+  }
+
+  test_threads();
+  test_quarks();
+  test_reload();
+  test_stats();
+  test_stats_threads();
+  test_trace();
+  test_limits();
+  test_checker_pool();
+  test_many_patterns();
+  test_deep(basic_mode, "<b>", "<b><b><b>");
+  test_deep(basic_mode, "<span>a", "aaa");
+  test_deep(default_mode, "<div>", " ");
+  test_stream_held();
+
+  {
+    /* both engines stop where the tree builder does, 256 elements deep */
+    char deep_html[300 * 3 + 2];
+    int i;
+
+    for (i = 0; i < 300; ++i)
+      memcpy(deep_html + 3 * i, "<b>", 3);
+    strcpy(deep_html + 900, "x");
+    test("deep-cutoff", default_mode, deep_html, "");
+    test_stream("stream-deep-cutoff", default_mode, deep_html, "");
+  }
+
+  {
+    /* a cycle of renames ends in the element being stripped */
+    struct sanitize_mode *cycle_mode = mode_memory("<mode><elements><b/></elements>"
+                                                   "<rename to='y'><x/></rename><rename to='x'><y/></rename></mode>");
+
+    test("rename-cycle", cycle_mode, "a<x>b</x>c<b>d</b>", "abc<b>d</b>");
+    test_stream("stream-rename-cycle", cycle_mode, "a<x>b</x>c<b>d</b>", "abc<b>d</b>");
+    mode_free(cycle_mode);
+  }
+
+  {
+    const char *samples[] = { basic_html, malformed_html, delete_html };
+    test_batch(relaxed_mode, samples, 3);
+  }
+  test_ctx_names(relaxed_mode);
+
+  test_empty("empty", relaxed_mode, "");
+  test_empty("empty-document", relaxed_mode, "<html><head></head></html>");
+  test_empty("empty-deleted", in_memory_mode, "<script>alert(1)</script><style>p {}</style>");
+
   mode_free(default_mode);
   mode_free(basic_mode);
   mode_free(relaxed_mode);
   mode_free(restricted_mode);
   mode_free(untrusted_mode);
   mode_free(in_memory_mode);
+  mode_free(regex_mode);
 
   int total = passed + failed;
   printf("Did %d checks.\n"
@@ -375,8 +1675,7 @@ int main(int argc, char *argv[])
 	 failed,
 	 failed * 100 / total);
 
-  xmlCleanupParser();
-  free_quarks();
+  sanitize_cleanup();
 
   return failed;
 }
@@ -0,0 +1,32 @@
+#include <stdio.h>
+
+#include <sanitize.h>
+
+/* mode-compile mode.xml mode.bin: writes the compiled image mode_load_compiled() maps */
+
+int main(int argc, char *argv[])
+{
+  struct sanitize_mode *mode;
+  int result;
+
+  if (argc != 3)
+    {
+      fprintf(stderr, "usage: %s mode.xml output\n", argv[0]);
+      return 2;
+    }
+
+  mode = mode_load(argv[1]);
+  if (!mode)
+    {
+      fprintf(stderr, "%s: cannot load %s\n", argv[0], argv[1]);
+      return 1;
+    }
+
+  result = mode_save_compiled(mode, argv[2]);
+  if (result)
+    fprintf(stderr, "%s: cannot write %s\n", argv[0], argv[2]);
+
+  mode_free(mode);
+  sanitize_cleanup();
+  return result ? 1 : 0;
+}